@@ -0,0 +1,134 @@
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+
+// keep at most this many free blocks in the pool
+const int ARENA_POOL_CAPACITY = 4096;
+// the object allocated by allocObject is prefixed by its arena, padded to keep the alignment
+const int ARENA_OBJECT_HEADER = 16;
+
+// the free blocks shared by all the arenas
+struct BlockPool {
+    mutex mMutex;
+    vector<char*> mFree;
+
+    ~BlockPool() {
+        for(int i=0; i<mFree.size(); i++)
+            free(mFree[i]);
+    }
+
+    static BlockPool& instance() {
+        static BlockPool pool;
+        return pool;
+    }
+};
+
+static inline size_t alignUp(size_t size) {
+    return (size + 15) & ~(size_t)15;
+}
+
+Arena::Arena() {
+    // the inline buffer may not be aligned in the owning object
+    mCur = (char*)alignUp((uintptr_t)mInline);
+    mAvailable = ARENA_INLINE_SIZE - (mCur - mInline);
+}
+
+Arena::~Arena() {
+    for(int i=0; i<mBlocks.size(); i++)
+        putBlock(mBlocks[i]);
+    for(int i=0; i<mLarge.size(); i++)
+        free(mLarge[i]);
+}
+
+char* Arena::getBlock() {
+    BlockPool& pool = BlockPool::instance();
+    {
+        lock_guard<mutex> lock(pool.mMutex);
+        if(!pool.mFree.empty()) {
+            char* block = pool.mFree.back();
+            pool.mFree.pop_back();
+            return block;
+        }
+    }
+    return (char*)malloc(ARENA_BLOCK_SIZE);
+}
+
+void Arena::putBlock(char* block) {
+    BlockPool& pool = BlockPool::instance();
+    {
+        lock_guard<mutex> lock(pool.mMutex);
+        if(pool.mFree.size() < ARENA_POOL_CAPACITY) {
+            pool.mFree.push_back(block);
+            return;
+        }
+    }
+    free(block);
+}
+
+void* Arena::alloc(size_t size) {
+    size = alignUp(size);
+    if(size > mAvailable) {
+        // a large one doesn't waste the rest of current block
+        if(size > ARENA_BLOCK_SIZE / 2) {
+            char* p = (char*)malloc(size);
+            mLarge.push_back(p);
+            return p;
+        }
+        mCur = getBlock();
+        mAvailable = ARENA_BLOCK_SIZE;
+        mBlocks.push_back(mCur);
+    }
+    char* p = mCur;
+    mCur += size;
+    mAvailable -= size;
+    return p;
+}
+
+void* Arena::allocObject(size_t size, Arena* arena) {
+    char* p = NULL;
+    if(arena)
+        p = (char*)arena->alloc(size + ARENA_OBJECT_HEADER);
+    else
+        p = (char*)malloc(size + ARENA_OBJECT_HEADER);
+    if(p == NULL)
+        throw std::bad_alloc();
+    *(Arena**)p = arena;
+    return p + ARENA_OBJECT_HEADER;
+}
+
+void Arena::freeObject(void* p) {
+    if(p == NULL)
+        return;
+    char* header = (char*)p - ARENA_OBJECT_HEADER;
+    if(*(Arena**)header == NULL)
+        free(header);
+}
+
+bool Arena::test() {
+    bool passed = true;
+    Arena* arena = new Arena();
+    char* last = NULL;
+    // fill the inline buffer, some blocks, and some large allocations
+    for(int i=0; i<1000; i++) {
+        size_t size = (i % 100 == 99) ? ARENA_BLOCK_SIZE : 1 + i % 200;
+        char* p = (char*)arena->alloc(size);
+        passed &= ((uintptr_t)p & 15) == 0;
+        memset(p, i & 0xFF, size);
+        if(last)
+            passed &= last != p;
+        last = p;
+    }
+    passed &= arena->mBlocks.size() > 0 && arena->mLarge.size() == 10;
+
+    void* obj = allocObject(100, arena);
+    void* heapObj = allocObject(100, NULL);
+    passed &= ((uintptr_t)obj & 15) == 0 && ((uintptr_t)heapObj & 15) == 0;
+    freeObject(obj);
+    freeObject(heapObj);
+    delete arena;
+
+    if(!passed)
+        cerr << "Arena::test failed" << endl;
+    return passed;
+}
@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <mutex>
+
+using namespace std;
+
+// the first bytes are allocated in the arena itself, so a small cluster doesn't need any block
+const int ARENA_INLINE_SIZE = 1024;
+const int ARENA_BLOCK_SIZE = 4096;
+
+// A bump allocator for the objects of one cluster: its pairs, groups and their score buffers
+// The memory is not freed one by one, but released together when the arena is destroyed
+// The blocks are recycled through a pool shared by all the threads
+
+class Arena {
+public:
+    Arena();
+    ~Arena();
+
+    // the memory is aligned to 16 bytes and not initialized
+    void* alloc(size_t size);
+
+    // for the class specific operator new/delete: the object is allocated in arena, or by malloc if arena is NULL
+    // the object can be deleted as usual, the memory allocated in an arena is just kept until the arena is destroyed
+    static void* allocObject(size_t size, Arena* arena);
+    static void freeObject(void* p);
+
+    static bool test();
+
+private:
+    static char* getBlock();
+    static void putBlock(char* block);
+
+private:
+    char mInline[ARENA_INLINE_SIZE];
+    char* mCur;
+    size_t mAvailable;
+    // the blocks from the pool
+    vector<char*> mBlocks;
+    // the allocations larger than a block
+    vector<char*> mLarge;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "bampool.h"
+
+// keep at most this many free records
+const int BAM_POOL_CAPACITY = 65536;
+
+BamPool* BamPool::instance() {
+    // initialized once even if it's called by multiple threads
+    static BamPool pool(BAM_POOL_CAPACITY);
+    return &pool;
+}
+
+BamPool::BamPool(int capacity) {
+    mCapacity = capacity;
+    mHits = 0;
+    mMisses = 0;
+}
+
+BamPool::~BamPool() {
+    for(int i=0; i<mFree.size(); i++)
+        bam_destroy1(mFree[i]);
+    mFree.clear();
+}
+
+bam1_t* BamPool::get() {
+    {
+        lock_guard<mutex> lock(mMutex);
+        if(!mFree.empty()) {
+            bam1_t* b = mFree.back();
+            mFree.pop_back();
+            mHits++;
+            return b;
+        }
+        mMisses++;
+    }
+    return bam_init1();
+}
+
+void BamPool::put(bam1_t* b) {
+    if(b == NULL)
+        return;
+    {
+        lock_guard<mutex> lock(mMutex);
+        if(mFree.size() < mCapacity) {
+            // clear the record, but keep its data buffer
+            b->core.tid = -1;
+            b->core.pos = -1;
+            b->l_data = 0;
+            b->id = 0;
+            mFree.push_back(b);
+            return;
+        }
+    }
+    bam_destroy1(b);
+}
+
+long BamPool::getHits() {
+    lock_guard<mutex> lock(mMutex);
+    return mHits;
+}
+
+long BamPool::getMisses() {
+    lock_guard<mutex> lock(mMutex);
+    return mMisses;
+}
+
+bool BamPool::test() {
+    BamPool pool(2);
+    bool passed = true;
+
+    bam1_t* b1 = pool.get();
+    bam1_t* b2 = pool.get();
+    bam1_t* b3 = pool.get();
+    passed &= pool.getMisses() == 3 && pool.getHits() == 0;
+
+    pool.put(b1);
+    pool.put(b2);
+    // the pool is full, b3 is destroyed
+    pool.put(b3);
+    passed &= pool.get() == b2;
+    passed &= pool.get() == b1;
+    passed &= pool.getMisses() == 3 && pool.getHits() == 2;
+
+    bam_destroy1(b1);
+    bam_destroy1(b2);
+
+    if(!passed)
+        cerr << "BamPool::test failed" << endl;
+    return passed;
+}
@@ -0,0 +1,44 @@
+#ifndef BAM_POOL_H
+#define BAM_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "htslib/sam.h"
+#include <vector>
+#include <mutex>
+#include <iostream>
+
+using namespace std;
+
+// Singleton pool of bam1_t records
+// The records are recycled with their data buffers, so that the ingest loop doesn't malloc/free for every read
+
+class BamPool {
+public:
+    ~BamPool();
+
+    // get a record, it's allocated only when the pool is empty
+    bam1_t* get();
+    // give back a record, it's destroyed if the pool is full
+    void put(bam1_t* b);
+
+    long getHits();
+    long getMisses();
+
+    static BamPool* instance();
+
+    static bool test();
+
+private:
+    BamPool(int capacity);
+
+private:
+    vector<bam1_t*> mFree;
+    int mCapacity;
+    long mHits;
+    long mMisses;
+    // the records are got and put by multiple threads
+    mutex mMutex;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "bamreader.h"
+#include "bampool.h"
+#include "util.h"
+#include <string.h>
+#include <unistd.h>
+
+// the records of a batch are handed over together, and a limited number of batches can be read ahead
+const int READER_BATCH_SIZE = 256;
+const int READER_QUEUE_BATCHES = 16;
+
+BamReader::BamReader(samFile* in, bam_hdr_t* hdr, hts_itr_t* itr, Options* opt) : mQueue(READER_QUEUE_BATCHES) {
+    mIn = in;
+    mHeader = hdr;
+    mItr = itr;
+    mOptions = opt;
+    mBatch = NULL;
+    mBatchPos = 0;
+    mStopped = false;
+    mThread = new thread(&BamReader::run, this);
+}
+
+BamReader::~BamReader() {
+    stop();
+}
+
+void BamReader::detectUMIPrefix(bam1_t* b, Options* opt) {
+    if(opt->umiPrefix == "auto") {
+        string umi = BamUtil::getQName(b);
+        if(umi.find("umi_") != string::npos)
+            opt->umiPrefix = "umi";
+        else if(umi.find("UMI_") != string::npos)
+            opt->umiPrefix = "UMI";
+        else
+            opt->umiPrefix = "";
+
+        if(!opt->umiPrefix.empty())
+            cerr << endl << "Detected UMI prefix: " << opt->umiPrefix << endl << endl;
+    }
+}
+
+void BamReader::run() {
+    bool isFirst = true;
+    bool finished = false;
+    while(!finished && !mStopped) {
+        vector<Record>* batch = new vector<Record>();
+        batch->reserve(READER_BATCH_SIZE);
+        while(batch->size() < READER_BATCH_SIZE) {
+            bam1_t* b = BamPool::instance()->get();
+            int r = mItr ? sam_itr_next(mIn, mItr, b) : sam_read1(mIn, mHeader, b);
+            if(r < 0) {
+                BamPool::instance()->put(b);
+                finished = true;
+                break;
+            }
+            // for the first read, check UMI prefix automatically
+            if(isFirst) {
+                detectUMIPrefix(b, mOptions);
+                isFirst = false;
+            }
+            Record rec;
+            rec.b = b;
+            // only the primary mapped reads with a mapped mate are clustered, don't parse the UMIs of the others
+            if(b->core.tid >= 0 && b->core.pos >= 0 && b->core.mtid >= 0 && BamUtil::isPrimary(b))
+                rec.info = BamUtil::getReadInfo(b, mOptions->umiPrefix);
+            else
+                rec.info.primary = BamUtil::isPrimary(b);
+            batch->push_back(rec);
+        }
+        if(batch->empty())
+            delete batch;
+        else
+            mQueue.push(batch);
+    }
+    mQueue.close();
+}
+
+bam1_t* BamReader::next(BamReadInfo& info) {
+    while(mBatch == NULL || mBatchPos >= mBatch->size()) {
+        if(mBatch) {
+            delete mBatch;
+            mBatch = NULL;
+        }
+        if(mThread == NULL || !mQueue.pop(mBatch)) {
+            mBatch = NULL;
+            return NULL;
+        }
+        mBatchPos = 0;
+    }
+    Record& rec = (*mBatch)[mBatchPos];
+    mBatchPos++;
+    info = rec.info;
+    return rec.b;
+}
+
+void BamReader::stop() {
+    if(mThread == NULL)
+        return;
+    mStopped = true;
+    // take the queued batches, so that the reader is not blocked and can see mStopped
+    BamReadInfo info;
+    bam1_t* b = NULL;
+    while((b = next(info)) != NULL)
+        BamPool::instance()->put(b);
+    mThread->join();
+    delete mThread;
+    mThread = NULL;
+}
+
+bool BamReader::test() {
+    bool passed = true;
+    bam_hdr_t* hdr = bam_hdr_init();
+    hdr->n_targets = 1;
+    hdr->target_len = (uint32_t*)malloc(sizeof(uint32_t));
+    hdr->target_len[0] = 100000;
+    hdr->target_name = (char**)malloc(sizeof(char*));
+    hdr->target_name[0] = strdup("chr1");
+
+    string filename = "gencore.readertest." + to_string(getpid()) + ".bam";
+    samFile* out = sam_open(filename.c_str(), "wb0");
+    if(!out || sam_hdr_write(out, hdr) < 0) {
+        cerr << "BamReader::test failed to open " << filename << endl;
+        bam_hdr_destroy(hdr);
+        return false;
+    }
+    // more records than a batch, and every 10th of them is secondary
+    const int num = READER_BATCH_SIZE * 2 + 3;
+    bam1_t* b = bam_init1();
+    for(int i=0; i<num; i++) {
+        string qname = "read" + to_string(i) + ":umi_ACGT";
+        b->l_data = b->m_data = qname.length() + 1;
+        b->data = (uint8_t*)realloc(b->data, b->m_data);
+        memcpy(b->data, qname.c_str(), qname.length() + 1);
+        b->core.l_qname = qname.length() + 1;
+        b->core.n_cigar = 0;
+        b->core.l_qseq = 0;
+        b->core.tid = 0;
+        b->core.mtid = 0;
+        b->core.pos = i;
+        b->core.flag = (i % 10 == 0) ? BAM_FSECONDARY : 0;
+        sam_write1(out, hdr, b);
+    }
+    bam_destroy1(b);
+    sam_close(out);
+
+    Options opt;
+    opt.umiPrefix = "auto";
+    samFile* in = sam_open(filename.c_str(), "r");
+    bam_hdr_t* inHeader = sam_hdr_read(in);
+    int count = 0;
+    {
+        BamReader reader(in, inHeader, NULL, &opt);
+        BamReadInfo info;
+        while((b = reader.next(info)) != NULL) {
+            bool primary = (count % 10 != 0);
+            passed &= b->core.pos == count && info.primary == primary;
+            if(primary)
+                passed &= info.qnameHash == BamUtil::getQNameHash(b) && info.umi == PackedUMI::pack("ACGT") && info.endPos == count;
+            BamPool::instance()->put(b);
+            count++;
+        }
+    }
+    passed &= count == num && opt.umiPrefix == "umi";
+    bam_hdr_destroy(inHeader);
+    sam_close(in);
+
+    // stop before the input is finished
+    in = sam_open(filename.c_str(), "r");
+    inHeader = sam_hdr_read(in);
+    {
+        BamReader reader(in, inHeader, NULL, &opt);
+        BamReadInfo info;
+        b = reader.next(info);
+        passed &= b != NULL && b->core.pos == 0;
+        BamPool::instance()->put(b);
+        reader.stop();
+        passed &= reader.next(info) == NULL;
+    }
+    bam_hdr_destroy(inHeader);
+    sam_close(in);
+
+    remove(filename.c_str());
+    bam_hdr_destroy(hdr);
+
+    if(!passed)
+        cerr << "BamReader::test failed" << endl;
+    return passed;
+}
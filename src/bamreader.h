@@ -0,0 +1,57 @@
+#ifndef BAM_READER_H
+#define BAM_READER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "htslib/sam.h"
+#include "options.h"
+#include "bamutil.h"
+#include "spscqueue.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+// Decodes the input records in a dedicated thread
+// The records are handed over in batches with their BamReadInfo, so that decoding runs ahead of making consensus reads
+
+class BamReader {
+public:
+    // read all the records of in, or only the records of itr if it's not NULL
+    // the UMI prefix is detected by the first record if it's "auto"
+    BamReader(samFile* in, bam_hdr_t* hdr, hts_itr_t* itr, Options* opt);
+    ~BamReader();
+
+    // the next record, which is owned by the caller, NULL if the input is finished
+    // the UMI, the end position and the sequence hash of info are only derived for the records to cluster: primary, and mapped with a mapped mate
+    bam1_t* next(BamReadInfo& info);
+    // stop reading, the records not taken by next() are given back to BamPool
+    void stop();
+
+    static void detectUMIPrefix(bam1_t* b, Options* opt);
+
+    static bool test();
+
+private:
+    struct Record {
+        bam1_t* b;
+        BamReadInfo info;
+    };
+
+    void run();
+
+private:
+    samFile* mIn;
+    bam_hdr_t* mHeader;
+    hts_itr_t* mItr;
+    Options* mOptions;
+    SpscQueue<vector<Record>*> mQueue;
+    // the batch being taken by next()
+    vector<Record>* mBatch;
+    int mBatchPos;
+    thread* mThread;
+    atomic<bool> mStopped;
+};
+
+#endif
@@ -20,95 +20,128 @@ string BamUtil::getQName(const bam1_t *b) {
     return string(bam_get_qname(b), b->core.l_qname);
 }
 
-string BamUtil::getUMI(const bam1_t *b, const string& prefix) {
-    // if there is a MI tag, read the tag, otherwise read the qname 
+uint64_t BamUtil::getQNameHash(const bam1_t *b) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const char* qname = bam_get_qname(b);
+    for(int i=0; qname[i] != '\0'; i++) {
+        hash ^= (uint8_t)qname[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+uint64_t BamUtil::getSeqHash(const bam1_t *b) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const uint8_t* cigar = (const uint8_t*)bam_get_cigar(b);
+    int cigarBytes = b->core.n_cigar * sizeof(uint32_t);
+    for(int i=0; i<cigarBytes; i++) {
+        hash ^= cigar[i];
+        hash *= 0x100000001b3ULL;
+    }
+    const uint8_t* seq = bam_get_seq(b);
+    int seqBytes = (b->core.l_qseq + 1) / 2;
+    for(int i=0; i<seqBytes; i++) {
+        hash ^= seq[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// the UMI string of the read, from the MI tag if there is one, otherwise from the qname
+static const char* getUMISource(const bam1_t *b) {
     const char umitag[2] = {'M', 'I'};
     uint8_t* umidata = bam_aux_get(b, umitag);
-    if(!umidata) {
-        return getUMI(string(bam_get_qname(b)), prefix);
-    }
-    else {
+    if(umidata) {
         const char* str = bam_aux2Z(umidata);
-        if(!str) {
-            return getUMI(string(bam_get_qname(b)), prefix);
-        }
-        string umistr = string(str);
-        return getUMI(umistr, prefix);
+        if(str)
+            return str;
     }
+    return bam_get_qname(b);
+}
+
+string BamUtil::getUMI(const bam1_t *b, const string& prefix) {
+    const char* str = getUMISource(b);
+    int start, umiLen;
+    if(!findUMI(str, strlen(str), prefix, start, umiLen))
+        return "";
+    return string(str + start, umiLen);
+}
+
+PackedUMI BamUtil::getPackedUMI(const bam1_t *b, const string& prefix) {
+    const char* str = getUMISource(b);
+    int start, umiLen;
+    if(!findUMI(str, strlen(str), prefix, start, umiLen))
+        return PackedUMI();
+    return PackedUMI::pack(str + start, umiLen);
 }
 
 string BamUtil::getUMI(string qname, const string& prefix) {
-    int len = qname.length();
+    int start, umiLen;
+    if(!findUMI(qname.c_str(), qname.length(), prefix, start, umiLen))
+        return "";
+    return qname.substr(start, umiLen);
+}
+
+static inline bool isUMIChar(char c) {
+    return c == 'A' || c == 'T' || c == 'C' || c == 'G' || c == '_';
+}
+
+bool BamUtil::findUMI(const char* qname, int len, const string& prefix, int& start, int& umiLen) {
     int prefixLen = prefix.length();
+    start = 0;
+    umiLen = 0;
 
     // prefix mode
     if(prefixLen > 0) {
-        string::size_type pos = qname.find_last_of(prefix);
-        if(pos == string::npos)
-            return "";
-        bool foundSep = false;
-        bool found= false;
-        int umiLen = 0;
-        int sep = 0;
-        int start = pos + 2;
-        for(sep = start; sep<len; sep++) {
-            char c = qname[sep];
-            if(c!='A' && c!='T' && c!='C' && c!='G' && c!='_') {
-                foundSep = true;
+        // the last char that appears in the prefix
+        int pos = -1;
+        for(int i=len-1; i>=0; i--) {
+            if(prefix.find(qname[i]) != string::npos) {
+                pos = i;
                 break;
-            } else 
-                umiLen++;
+            }
         }
-        return qname.substr(start, umiLen);
-    }
-
-    bool foundSep = false;
-    bool found= false;
-    int sep = len-1;
-    for(sep = len-1; sep>=0; sep--) {
-        char c = qname[sep];
-        if(c == ':') {
-            foundSep = true;
-            break;
+        if(pos < 0)
+            return false;
+        start = pos + 2;
+        for(int i=start; i<len; i++) {
+            if(!isUMIChar(qname[i]))
+                break;
+            umiLen++;
         }
+        return umiLen > 0;
     }
 
-    if(!foundSep || sep + prefixLen >=len-1) {
-        if(prefixLen == 0)
-            return "";
-    }
-
-
-    // check prefix
-    bool goodPrefix = true;
-    for(int p=0; p<prefixLen; p++) {
-        if(prefix[p] != qname[sep + 1 + p]) {
-            goodPrefix = false;
+    int sep = -1;
+    for(int i=len-1; i>=0; i--) {
+        if(qname[i] == ':') {
+            sep = i;
             break;
         }
     }
+    if(sep < 0 || sep >= len-1)
+        return false;
 
-    if(!goodPrefix)
-        return "";
-
-    int start = sep + 1 + prefixLen;
+    start = sep + 1;
     if(start < len-1 && qname[start] == '_')
         start++;
 
     int numOfUnderscore = 0;
     for(int i=start; i<len; i++) {
         char c = qname[i];
-        // UMI can be only A/T/C/G/N/_
-        if(c != 'A' && c != 'T' && c != 'C' && c != 'G' && c != '_') {
-            return "";
-        }
+        // UMI can be only A/T/C/G/_
+        if(!isUMIChar(c))
+            return false;
         if(c == '_') {
             numOfUnderscore++;
             if(numOfUnderscore > 1)
-                return "";
+                return false;
         }
     }
-    return qname.substr(start, len-start);
+    umiLen = len - start;
+    return true;
 }
 
 string BamUtil::getQual(const bam1_t *b) {
@@ -313,6 +346,29 @@ int BamUtil::getRefOffset(bam1_t *b, int bampos) {
     return -1;
 }
 
+void BamUtil::getRefOffsets(bam1_t *b, vector<int>& offsets) {
+    uint32_t *data = (uint32_t *)bam_get_cigar(b);
+    int cigarNum = b->core.n_cigar;
+    // the positions not covered by the CIGAR are also -1
+    offsets.assign(b->core.l_qseq, -1);
+    int ref = 0;
+    int query = 0;
+    for(int i=0; i<cigarNum; i++) {
+        uint32_t val = data[i];
+        char op = bam_cigar_op(val);
+        uint32_t len = bam_cigar_oplen(val);
+        if(QUERY_CONSUM[op]) {
+            int end = min(query + (int)len, b->core.l_qseq);
+            if(REFERENCE_CONSUM[op]) {
+                for(int q=query; q<end; q++)
+                    offsets[q] = ref + q - query;
+            }
+            query += len;
+        }
+        ref += len * REFERENCE_CONSUM[op];
+    }
+}
+
 void BamUtil::getMOffsetAndLen(bam1_t *b, int& MOffset, int& MLen) {
     uint32_t *data = (uint32_t *)bam_get_cigar(b);
     int cigarNum = b->core.n_cigar;
@@ -382,6 +438,28 @@ int BamUtil::getRightRefPos(bam1_t *b) {
     return b->core.pos + bam_cigar2rlen(b->core.n_cigar, bam_get_cigar(b));
 }
 
+BamReadInfo BamUtil::getReadInfo(bam1_t *b, const string& umiPrefix) {
+    BamReadInfo info;
+    info.qnameHash = getQNameHash(b);
+    info.umi = getPackedUMI(b, umiPrefix);
+    info.endPos = getRightRefPos(b);
+    info.seqHash = getSeqHash(b);
+    info.primary = isPrimary(b);
+    return info;
+}
+
+// check whether there is a .bai/.csi/.crai index file for this bam/cram file
+bool BamUtil::hasIndex(const string& filename) {
+    if(filename.empty() || filename == "-")
+        return false;
+    if(file_exists(filename + ".bai") || file_exists(filename + ".csi") || file_exists(filename + ".crai"))
+        return true;
+    // the index can also be named like sample.bai for sample.bam
+    if(ends_with(filename, ".bam") && file_exists(filename.substr(0, filename.length() - 4) + ".bai"))
+        return true;
+    return false;
+}
+
 bool BamUtil::test() {
     vector<string> qnames;
     qnames.push_back("NB551106:8:H5Y57BGX2:1:13304:3538:1404");
@@ -418,6 +496,28 @@ bool BamUtil::test() {
         }
     }
 
+    // 3S5M2I4M3D6M2S
+    uint32_t cigar[] = {3<<4 | BAM_CSOFT_CLIP, 5<<4 | BAM_CMATCH, 2<<4 | BAM_CINS, 4<<4 | BAM_CMATCH,
+        3<<4 | BAM_CDEL, 6<<4 | BAM_CMATCH, 2<<4 | BAM_CSOFT_CLIP};
+    bam1_t* b = bam_init1();
+    b->core.l_qname = 4;
+    b->core.n_cigar = 7;
+    b->core.l_qseq = 22;
+    b->l_data = b->m_data = 4 + sizeof(cigar) + 11 + 22;
+    b->data = (uint8_t*)calloc(b->m_data, 1);
+    memcpy(b->data, "abc", 4);
+    memcpy(bam_get_cigar(b), cigar, sizeof(cigar));
+    vector<int> offsets;
+    getRefOffsets(b, offsets);
+    bool offsetsPassed = offsets.size() == 22 && offsets[0] == -1 && offsets[3] == 0 && offsets[8] == -1 && offsets[14] == 12;
+    for(int i=0; i<offsets.size(); i++)
+        offsetsPassed &= offsets[i] == getRefOffset(b, i);
+    bam_destroy1(b);
+    if(!offsetsPassed) {
+        cerr << "BamUtil::getRefOffsets failed" << endl;
+        return false;
+    }
+
     return true;
 
 }
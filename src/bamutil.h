@@ -6,9 +6,24 @@
 #include "util.h"
 #include "htslib/sam.h"
 #include "htslib/kstring.h"
+#include <vector>
+#include "umi.h"
 
 using namespace std;
 
+// the fields of a record used by the clustering stage, derived once when the record is decoded
+struct BamReadInfo {
+    uint64_t qnameHash;
+    PackedUMI umi;
+    // BamUtil::getRightRefPos
+    int endPos;
+    // BamUtil::getSeqHash
+    uint64_t seqHash;
+    bool primary;
+
+    BamReadInfo() : qnameHash(0), endPos(-1), seqHash(0), primary(false) {}
+};
+
 class BamUtil {
 public:
     BamUtil();
@@ -16,8 +31,14 @@ public:
 
 public:
     static string getQName(const bam1_t *b);
+    static uint64_t getQNameHash(const bam1_t *b);
+    // the hash of the CIGAR and the packed sequence, to find the identical reads
+    static uint64_t getSeqHash(const bam1_t *b);
     static string getUMI(string qname, const string& prefix);
     static string getUMI(const bam1_t *b, const string& prefix);
+    static PackedUMI getPackedUMI(const bam1_t *b, const string& prefix);
+    // find the UMI in qname without copying it, return false if there is no UMI
+    static bool findUMI(const char* qname, int len, const string& prefix, int& start, int& umiLen);
     static string getSeq(const bam1_t *b);
     static string getQual(const bam1_t *b);
     static string getCigar(const bam1_t *b);
@@ -27,15 +48,62 @@ public:
     static bool isPartOf(bam1_t *part, bam1_t *whole, bool isLeft);
     static void dumpHeader(bam_hdr_t* hdr);
     static int getRefOffset(bam1_t *b, int bampos);
+    // the reference offsets of all the query positions in one pass of the CIGAR, -1 for the inserted and clipped ones
+    static void getRefOffsets(bam1_t *b, vector<int>& offsets);
     static void copyQName(bam1_t *from, bam1_t *to);
     static bool isPrimary(bam1_t *b);
     static bool isProperPair(bam1_t *b);
     static int getRightRefPos(bam1_t *b);
     static void getMOffsetAndLen(bam1_t *b, int& MOffset, int& MLen);
     static int getED(const bam1_t* b);
+    static bool hasIndex(const string& filename);
+    static BamReadInfo getReadInfo(bam1_t *b, const string& umiPrefix);
 
     static bool test();
 
 };
 
+// the output order of a record, packed from its fields so that comparing two keys doesn't touch the records
+// mapped records are ordered by tid, pos, mtid, mpos, isize and then the emitting order, unmapped records are the last
+struct BamOrderKey {
+    // tid << 32 | pos + 1, or all 1s for the unmapped
+    uint64_t coord;
+    // mtid + 1 << 32 | mpos + 1
+    uint64_t mate;
+    int64_t isize;
+    // the emitting order, which is deterministic even with multiple threads
+    uint64_t id;
+    bam1_t* b;
+
+    BamOrderKey() : coord(0), mate(0), isize(0), id(0), b(NULL) {}
+
+    BamOrderKey(bam1_t* bam) {
+        b = bam;
+        id = bam->id;
+        if(bam->core.tid >= 0) {
+            coord = ((uint64_t)bam->core.tid << 32) | (uint32_t)(bam->core.pos + 1);
+            mate = ((uint64_t)(uint32_t)(bam->core.mtid + 1) << 32) | (uint32_t)(bam->core.mpos + 1);
+            isize = bam->core.isize;
+        } else {
+            coord = ~(uint64_t)0;
+            mate = 0;
+            isize = 0;
+        }
+    }
+
+    bool operator<(const BamOrderKey& other) const {
+        if(coord != other.coord)
+            return coord < other.coord;
+        if(mate != other.mate)
+            return mate < other.mate;
+        if(isize != other.isize)
+            return isize < other.isize;
+        return id < other.id;
+    }
+
+    bool operator>(const BamOrderKey& other) const {
+        return other < *this;
+    }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+#include "bamwriter.h"
+#include "bampool.h"
+#include "util.h"
+#include <string.h>
+#include <unistd.h>
+
+// the records of a batch are handed over together, and a limited number of batches can be queued
+const int WRITER_BATCH_SIZE = 256;
+const int WRITER_QUEUE_BATCHES = 64;
+
+BamWriter::BamWriter(samFile* out, bam_hdr_t* hdr, Stats* stats) : mQueue(WRITER_QUEUE_BATCHES) {
+    mOut = out;
+    mHeader = hdr;
+    mStats = stats;
+    mBatch = NULL;
+    mLastTid = -1;
+    mLastPos = -1;
+    mWarnedUnordered = false;
+    mThread = new thread(&BamWriter::run, this);
+}
+
+BamWriter::~BamWriter() {
+    finish();
+}
+
+void BamWriter::write(bam1_t* b) {
+    if(mBatch == NULL) {
+        mBatch = new vector<bam1_t*>();
+        mBatch->reserve(WRITER_BATCH_SIZE);
+    }
+    mBatch->push_back(b);
+    if(mBatch->size() >= WRITER_BATCH_SIZE)
+        flush();
+}
+
+void BamWriter::flush() {
+    if(mBatch == NULL)
+        return;
+    mQueue.push(mBatch);
+    mBatch = NULL;
+}
+
+void BamWriter::finish() {
+    if(mThread == NULL)
+        return;
+    flush();
+    mQueue.close();
+    mThread->join();
+    delete mThread;
+    mThread = NULL;
+}
+
+void BamWriter::run() {
+    vector<bam1_t*>* batch = NULL;
+    while(mQueue.pop(batch)) {
+        for(int i=0; i<batch->size(); i++) {
+            writeRecord((*batch)[i]);
+            BamPool::instance()->put((*batch)[i]);
+        }
+        delete batch;
+    }
+}
+
+void BamWriter::writeRecord(bam1_t* b) {
+    if(b->core.tid <mLastTid || (b->core.tid == mLastTid && b->core.pos <mLastPos)) {
+        // skip the -1:-1, which means unmapped
+        if(b->core.tid >=0 && b->core.pos >= 0) {
+            if(!mWarnedUnordered) {
+                cerr << "WARNING: The output will be unordered!" << endl;
+                mWarnedUnordered = true;
+            }
+        }
+    }
+    if(sam_write1(mOut, mHeader, b) <0) {
+        error_exit("Writing failed, exiting ...");
+    }
+    mLastTid = b->core.tid;
+    mLastPos = b->core.pos;
+
+    if(mStats)
+        mStats->addRead(b);
+}
+
+bool BamWriter::test() {
+    bool passed = true;
+    bam_hdr_t* hdr = bam_hdr_init();
+    hdr->n_targets = 1;
+    hdr->target_len = (uint32_t*)malloc(sizeof(uint32_t));
+    hdr->target_len[0] = 100000;
+    hdr->target_name = (char**)malloc(sizeof(char*));
+    hdr->target_name[0] = strdup("chr1");
+
+    string filename = "gencore.writertest." + to_string(getpid()) + ".bam";
+    samFile* out = sam_open(filename.c_str(), "wb0");
+    if(!out || sam_hdr_write(out, hdr) < 0) {
+        cerr << "BamWriter::test failed to open " << filename << endl;
+        bam_hdr_destroy(hdr);
+        return false;
+    }
+
+    // more records than a batch, and the last batch is not full
+    const int num = WRITER_BATCH_SIZE * 3 + 7;
+    Options opt;
+    Stats stats(&opt);
+    BamWriter writer(out, hdr, &stats);
+    for(int i=0; i<num; i++) {
+        bam1_t* b = BamPool::instance()->get();
+        if(b->m_data < 2) {
+            b->m_data = 2;
+            b->data = (uint8_t*)realloc(b->data, b->m_data);
+        }
+        b->l_data = 2;
+        b->data[0] = 'r';
+        b->data[1] = '\0';
+        b->core.l_qname = 2;
+        b->core.n_cigar = 0;
+        b->core.l_qseq = 0;
+        b->core.tid = 0;
+        b->core.mtid = -1;
+        b->core.pos = i;
+        writer.write(b);
+    }
+    writer.finish();
+    passed &= stats.mRead == num;
+    sam_close(out);
+
+    samFile* in = sam_open(filename.c_str(), "r");
+    if(in) {
+        bam_hdr_t* inHeader = sam_hdr_read(in);
+        bam1_t* b = bam_init1();
+        int count = 0;
+        while(sam_read1(in, inHeader, b) >= 0) {
+            passed &= b->core.pos == count;
+            count++;
+        }
+        passed &= count == num;
+        bam_destroy1(b);
+        if(inHeader)
+            bam_hdr_destroy(inHeader);
+        sam_close(in);
+    } else {
+        passed = false;
+    }
+    remove(filename.c_str());
+    bam_hdr_destroy(hdr);
+
+    if(!passed)
+        cerr << "BamWriter::test failed" << endl;
+    return passed;
+}
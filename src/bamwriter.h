@@ -0,0 +1,48 @@
+#ifndef BAM_WRITER_H
+#define BAM_WRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "htslib/sam.h"
+#include "stats.h"
+#include "spscqueue.h"
+#include <vector>
+#include <thread>
+
+using namespace std;
+
+// Writes the output records in a dedicated thread
+// The records are handed over in batches, so that making consensus reads and BGZF compression run at the same time
+
+class BamWriter {
+public:
+    // if stats is not NULL, the written records are added to it in the writer thread, so read it only after finish()
+    BamWriter(samFile* out, bam_hdr_t* hdr, Stats* stats);
+    ~BamWriter();
+
+    // queue a record to write, it's owned by the writer and given back to BamPool after it's written
+    void write(bam1_t* b);
+    // write all the queued records and stop the writer thread
+    void finish();
+
+    static bool test();
+
+private:
+    void flush();
+    void run();
+    void writeRecord(bam1_t* b);
+
+private:
+    samFile* mOut;
+    bam_hdr_t* mHeader;
+    Stats* mStats;
+    // the batch being filled by the producer
+    vector<bam1_t*>* mBatch;
+    SpscQueue<vector<bam1_t*>*> mQueue;
+    thread* mThread;
+    int mLastTid;
+    int mLastPos;
+    bool mWarnedUnordered;
+};
+
+#endif
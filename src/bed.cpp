@@ -107,6 +107,15 @@ void Bed::copyFrom(Bed* other) {
 	}
 }
 
+// add the depth counted by another Bed, which should be copied from this one
+void Bed::merge(Bed* other) {
+	for(int c=0; c<mContigRegions.size() && c<other->mContigRegions.size(); c++) {
+		for(int p=0; p<mContigRegions[c].size() && p<other->mContigRegions[c].size(); p++) {
+			mContigRegions[c][p].mCount += other->mContigRegions[c][p].mCount;
+		}
+	}
+}
+
 void Bed::loadFromFile() {
 	if(mOptions->bedFile.empty())
 		return;
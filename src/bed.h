@@ -49,6 +49,7 @@ public:
     Bed(Options* opt);
     void loadFromFile();
     void copyFrom(Bed* other);
+    void merge(Bed* other);
     void dump();
     void statDepth(int tid, int start, int len);
     void reportJSON(ofstream& ofs);
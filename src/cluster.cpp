@@ -3,101 +3,281 @@
 #include "reference.h"
 #include "group.h"
 #include <memory.h>
+#include <algorithm>
+#include <unordered_map>
 
 Cluster::Cluster(Options* opt){
     mOptions = opt;
 }
 
+// the clusters smaller than this are scanned without the slot table
+const int CLUSTER_SCAN_LIMIT = 8;
+
 Cluster::~Cluster(){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        delete iter->second;
+    for(int i=0; i<mPairs.size(); i++) {
+        delete mPairs[i];
     }
 }
 
 void Cluster::addPair(Pair* p){
-    string qname = p->getQName();
-    if(mPairs.count(qname)>0)
-        delete mPairs[qname];
-    mPairs[qname] = p;
+    bam1_t* b = p->mLeft ? p->mLeft : p->mRight;
+    if(b == NULL)
+        return;
+    uint64_t hash = BamUtil::getQNameHash(b);
+    int index = findPair(hash, bam_get_qname(b));
+    if(index >= 0) {
+        delete mPairs[index];
+        mPairs[index] = p;
+    } else {
+        insertPair(hash, p);
+    }
+}
+
+int Cluster::findPair(uint64_t hash, const char* qname) {
+    if(mSlots.empty()) {
+        for(int i=0; i<mPairHashes.size(); i++) {
+            if(mPairHashes[i] == hash && strcmp(mPairs[i]->getQNameData(), qname) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    int mask = mSlots.size() - 1;
+    int slot = hash & mask;
+    while(mSlots[slot] >= 0) {
+        int index = mSlots[slot];
+        if(mPairHashes[index] == hash && strcmp(mPairs[index]->getQNameData(), qname) == 0)
+            return index;
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+void Cluster::insertPair(uint64_t hash, Pair* p) {
+    mPairs.push_back(p);
+    mPairHashes.push_back(hash);
+
+    int count = mPairs.size();
+    if(mSlots.empty()) {
+        if(count > CLUSTER_SCAN_LIMIT)
+            rebuildSlots(CLUSTER_SCAN_LIMIT * 4);
+        return;
+    }
+    // keep the load factor under 0.5
+    if(count * 2 > mSlots.size()) {
+        rebuildSlots(mSlots.size() * 2);
+        return;
+    }
+    int mask = mSlots.size() - 1;
+    int slot = hash & mask;
+    while(mSlots[slot] >= 0)
+        slot = (slot + 1) & mask;
+    mSlots[slot] = count - 1;
+}
+
+void Cluster::rebuildSlots(int size) {
+    mSlots.assign(size, -1);
+    int mask = size - 1;
+    for(int i=0; i<mPairs.size(); i++) {
+        int slot = mPairHashes[i] & mask;
+        while(mSlots[slot] >= 0)
+            slot = (slot + 1) & mask;
+        mSlots[slot] = i;
+    }
 }
 
 void Cluster::dump(){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        iter->second->dump();
+    for(int i=0; i<mPairs.size(); i++) {
+        mPairs[i]->dump();
     }
 }
 
 bool Cluster::matches(Pair* p){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        if(iter->second->isDupWith(p))
+    for(int i=0; i<mPairs.size(); i++) {
+        if(mPairs[i]->isDupWith(p))
             return true;
     }
     return false;
 }
 
-int Cluster::umiDiff(const string& umi1, const string& umi2) {
+// the number of same-layout UMIs within threshold substitutions of a UMI with len bases, capped at limit
+static long countNeighbours(int len, int threshold, long limit) {
+    long total = 0;
+    long choose = 1;
+    long subs = 1;
+    for(int k=1; k<=threshold && k<=len; k++) {
+        choose = choose * (len - k + 1) / k;
+        subs *= 3;
+        total += choose * subs;
+        if(total >= limit)
+            return limit;
+    }
+    return total;
+}
 
-    int len1 = umi1.length();
-    int len2 = umi2.length();
+// visit the UMIs made by substituting at most threshold bases at positions[from...]
+template<typename Visitor>
+static void visitNeighbours(uint64_t bases, const vector<int>& positions, int from, int threshold, Visitor& visit) {
+    for(int i=from; i<positions.size(); i++) {
+        int shift = 2 * positions[i];
+        // XOR with 1/2/3 gives the other three bases
+        for(uint64_t alt=1; alt<4; alt++) {
+            uint64_t neighbour = bases ^ (alt << shift);
+            visit(neighbour);
+            if(threshold > 1)
+                visitNeighbours(neighbour, positions, i+1, threshold-1, visit);
+        }
+    }
+}
 
-    int  diff = abs(len1 - len2);
-    for(int i=0; i<min(len1, len2); i++) {
-        if(umi1[i] != umi2[i])
-             diff++;
+// find the unique UMIs within threshold of a UMI
+// if all UMIs have the same length and '_' positions, their diff is the Hamming distance of bases,
+// so the UMIs within threshold are found by enumerating the substitutions and probing a hash of the bases
+class UMINeighbourFinder {
+public:
+    UMINeighbourFinder(const vector<PackedUMI>& uniqueUMIs, int threshold) : mUMIs(uniqueUMIs) {
+        mThreshold = threshold;
+        int num = mUMIs.size();
+        bool sameLayout = num > 0 && mUMIs[0].packed();
+        for(int u=1; u<num && sameLayout; u++)
+            sameLayout = mUMIs[u].mLen == mUMIs[0].mLen && mUMIs[u].mUnderscores == mUMIs[0].mUnderscores;
+        if(sameLayout) {
+            for(int i=0; i<mUMIs[0].mLen; i++) {
+                if(!(mUMIs[0].mUnderscores & (1ULL << (2*i))))
+                    mPositions.push_back(i);
+            }
+        }
+        // enumerate only if it's cheaper than scanning
+        mUseIndex = threshold > 0 && sameLayout && countNeighbours(mPositions.size(), threshold, num) < num;
+        if(mUseIndex) {
+            mIndex.reserve(num * 2);
+            for(int u=0; u<num; u++)
+                mIndex[mUMIs[u].mBases] = u;
+        }
     }
 
-    return diff;
+    // call visit(v) for each unique UMI v != u within threshold
+    template<typename Visitor>
+    void visit(int u, Visitor& visit) {
+        if(mThreshold <= 0)
+            return;
+        if(mUseIndex) {
+            auto probe = [&](uint64_t bases) {
+                unordered_map<uint64_t, int>::iterator iter = mIndex.find(bases);
+                if(iter != mIndex.end())
+                    visit(iter->second);
+            };
+            visitNeighbours(mUMIs[u].mBases, mPositions, 0, mThreshold, probe);
+        } else {
+            for(int v=0; v<mUMIs.size(); v++) {
+                if(v != u && PackedUMI::diff(mUMIs[u], mUMIs[v]) <= mThreshold)
+                    visit(v);
+            }
+        }
+    }
+
+private:
+    const vector<PackedUMI>& mUMIs;
+    int mThreshold;
+    bool mUseIndex;
+    vector<int> mPositions;
+    unordered_map<uint64_t, int> mIndex;
+};
+
+int Cluster::groupUMIs(const vector<PackedUMI>& umis, int threshold, Options::UMIMethod method, vector<int>& groupOfUMIs) {
+    int num = umis.size();
+    groupOfUMIs.assign(num, -1);
+    if(num == 0)
+        return 0;
+
+    // collapse to unique UMIs, which are in string order
+    vector<int> sorted(num);
+    for(int i=0; i<num; i++)
+        sorted[i] = i;
+    sort(sorted.begin(), sorted.end(), [&umis](int a, int b) {return umis[a] < umis[b];});
+    vector<int> uniqueOf(num);
+    vector<PackedUMI> uniqueUMIs;
+    vector<int> counts;
+    for(int i=0; i<num; i++) {
+        if(i == 0 || umis[sorted[i-1]] != umis[sorted[i]]) {
+            uniqueUMIs.push_back(umis[sorted[i]]);
+            counts.push_back(0);
+        }
+        uniqueOf[sorted[i]] = counts.size() - 1;
+        counts.back()++;
+    }
+    int uniqueNum = counts.size();
+
+    // the UMIs with most reads come first, and the smaller one if tied
+    vector<int> order(uniqueNum);
+    for(int u=0; u<uniqueNum; u++)
+        order[u] = u;
+    stable_sort(order.begin(), order.end(), [&counts](int a, int b) {return counts[a] > counts[b];});
+
+    UMINeighbourFinder finder(uniqueUMIs, threshold);
+    vector<int> groupOfUnique(uniqueNum, -1);
+    int groupNum = 0;
+    vector<int> queue;
+    for(int k=0; k<uniqueNum; k++) {
+        int top = order[k];
+        if(groupOfUnique[top] >= 0)
+            continue;
+        int group = groupNum++;
+        groupOfUnique[top] = group;
+
+        if(method == Options::UMIGreedy) {
+            // the top UMI takes the ungrouped UMIs within threshold
+            auto absorb = [&](int v) {
+                if(groupOfUnique[v] < 0)
+                    groupOfUnique[v] = group;
+            };
+            finder.visit(top, absorb);
+        } else {
+            // directional: a UMI takes its neighbours with count <= (its count + 1) / 2, and so on
+            // cluster: the connected component of the neighbours
+            bool directional = method == Options::UMIDirectional;
+            queue.clear();
+            queue.push_back(top);
+            for(int q=0; q<queue.size(); q++) {
+                int u = queue[q];
+                auto absorb = [&](int v) {
+                    if(groupOfUnique[v] >= 0)
+                        return;
+                    if(directional && counts[u] < 2 * counts[v] - 1)
+                        return;
+                    groupOfUnique[v] = group;
+                    queue.push_back(v);
+                };
+                finder.visit(u, absorb);
+            }
+        }
+    }
+
+    for(int i=0; i<num; i++)
+        groupOfUMIs[i] = groupOfUnique[uniqueOf[i]];
+    return groupNum;
 }
-    
+
 vector<Pair*> Cluster::clusterByUMI(int umiDiffThreshold, Stats* preStats, Stats* postStats, bool crossContig) {
-	vector<Group*> groups;
-    map<string, int> umiCount;
     bool hasUMI = false;
-    map<string, Pair*>::iterator iterOfPairs;
-    for(iterOfPairs = mPairs.begin(); iterOfPairs!=mPairs.end(); iterOfPairs++) {
-        string umi = iterOfPairs->second->getUMI();
-        if(!umi.empty())
+    vector<PackedUMI> umis(mPairs.size());
+    for(int i=0; i<mPairs.size(); i++) {
+        umis[i] = mPairs[i]->getUMI();
+        if(!umis[i].empty())
             hasUMI = true;
-        umiCount[umi]++;
     }
-	while(mPairs.size()>0) {
-        // get top UMI
-        string topUMI;
-        int topCount = 0;
-        map<string, int>::iterator iter;
-        for(iter = umiCount.begin(); iter!=umiCount.end(); iter++) {
-            if(iter->second > topCount) {
-                topCount = iter->second;
-                topUMI = iter->first;
-            }
-        }
+    vector<int> groupOfPairs;
+    int groupNum = groupUMIs(umis, umiDiffThreshold, mOptions->umiMethod, groupOfPairs);
 
-        Group* c = new Group(mOptions);
-        bool isPE = false;
-
-		// create the group by the top UMI
-        map<string, Pair*>::iterator piter;
-        for(piter = mPairs.begin(); piter!=mPairs.end();){
-    		Pair* p = piter->second;
-            string umi = p->getUMI();
-            if(umiDiff(umi, topUMI) <= umiDiffThreshold) {
-                c->addPair(p);
-                if(p->mLeft && p->mRight)
-                    isPE = true;
-                piter = mPairs.erase(piter);
-                umiCount[umi] = 0;
-            } else {
-                piter++;
-            }
-        }
-        //if(mPairs.size()>0 || groups.size()>0)
-        //    cerr << "UMI " << topUMI<< " " << topCount << "/" << c->mPairs.size() << endl;
-        groups.push_back(c);
-        umiCount[topUMI] = 0;
-	}
+	vector<Group*> groups(groupNum);
+    for(int g=0; g<groupNum; g++)
+        groups[g] = new (&mArena) Group(mOptions, &mArena);
+    for(int i=0; i<mPairs.size(); i++)
+        groups[groupOfPairs[i]]->addPair(mPairs[i]);
+    // the pairs have been moved to groups
+    mPairs.clear();
+    mPairHashes.clear();
+    mSlots.clear();
 
     preStats->addCluster(groups.size()>1);
 
@@ -108,6 +288,8 @@ vector<Pair*> Cluster::clusterByUMI(int umiDiffThreshold, Stats* preStats, Stats
 
 	for(int i=0; i<groups.size(); i++) {
 		Pair* p = groups[i]->consensusMerge(crossContig);
+		if(groups[i]->mFastPath)
+			postStats->addFastPathGroup();
 		singleConsensusPairs.push_back(p);
 		delete groups[i];
 		groups[i] = NULL;
@@ -121,12 +303,12 @@ vector<Pair*> Cluster::clusterByUMI(int umiDiffThreshold, Stats* preStats, Stats
         while(singleConsensusPairs.size() > 0) {
             Pair* p1 = singleConsensusPairs.back();
             singleConsensusPairs.pop_back();
-            string umi1  = p1->getUMI();
+            const PackedUMI& umi1  = p1->getUMI();
             bool foundDuplex = false;
             for(int i=0;i<singleConsensusPairs.size(); i++) {
-                string umi2 = singleConsensusPairs[i]->getUMI();
+                const PackedUMI& umi2 = singleConsensusPairs[i]->getUMI();
                 // a duplex
-                if( isDuplex(umi1, umi2)) {
+                if( PackedUMI::isDuplex(umi1, umi2)) {
                     //cerr << "duplex:" << umi1 << ", " << umi2;
                     foundDuplex = true;
                     Pair* p2 = singleConsensusPairs[i];
@@ -196,6 +378,36 @@ int Cluster::duplexMerge(Pair* p1, Pair* p2) {
     return diff;
 }
 
+// mask the bases at pos of both reads as N with 0 quality if they are different, return 1 if they are masked
+// the codes other than A/C/G/T/N are compared as N
+static inline int duplexMergeBase(uint8_t* seq1, uint8_t* seq2, uint8_t* qual1, uint8_t* qual2, int pos) {
+    static const uint8_t canonical[16] = {15, 1, 2, 15, 4, 15, 15, 15, 8, 15, 15, 15, 15, 15, 15, 15};
+    int shift = (~pos & 1) << 2;
+    uint8_t base1 = (seq1[pos/2] >> shift) & 0xF;
+    uint8_t base2 = (seq2[pos/2] >> shift) & 0xF;
+    if(canonical[base1] == canonical[base2])
+        return 0;
+    qual1[pos] = 0;
+    qual2[pos] = 0;
+    uint8_t N4bits = 15;
+    seq1[pos/2] = (seq1[pos/2] & ~(0xF << shift)) | (N4bits << shift);
+    seq2[pos/2] = (seq2[pos/2] & ~(0xF << shift)) | (N4bits << shift);
+    return 1;
+}
+
+// mask the mismatched bases in the bytes [start, end) of the packed sequences
+static inline int duplexMergeBytes(uint8_t* seq1, uint8_t* seq2, uint8_t* qual1, uint8_t* qual2, int start, int end) {
+    int diff = 0;
+    for(int i=start; i<end; i++) {
+        // two bases encoded in one byte: identical
+        if(seq1[i] == seq2[i])
+            continue;
+        diff += duplexMergeBase(seq1, seq2, qual1, qual2, i*2);
+        diff += duplexMergeBase(seq1, seq2, qual1, qual2, i*2 + 1);
+    }
+    return diff;
+}
+
 int Cluster::duplexMergeBam(bam1_t* b1, bam1_t* b2) {
     int len1 = b1->core.l_qseq;
     int len2 = b2->core.l_qseq;
@@ -206,83 +418,197 @@ int Cluster::duplexMergeBam(bam1_t* b1, bam1_t* b2) {
     uint8_t * qual1 = bam_get_qual(b1);
     uint8_t * qual2 = bam_get_qual(b2);
 
-    uint8_t N4bits = BamUtil::base2fourbits('N');
-    for(int i=0; i<len; i++) {
-        // two bases encoded in one byte: identical
-        if(seq1[i/2] == seq2[i/2]) {
-            i++;
-            continue;
-        }
-        char base1, base2;
-        if(i%2 == 1) {
-            base1 = BamUtil::fourbits2base(seq1[i/2] & 0xF);
-            base2 = BamUtil::fourbits2base(seq2[i/2] & 0xF);
-        } else {
-            base1 = BamUtil::fourbits2base((seq1[i/2]>>4) & 0xF);
-            base2 = BamUtil::fourbits2base((seq2[i/2]>>4) & 0xF);
-        }
-        if(base1 != base2) {
-            diff++;
-            //set qual of the two bases to 0
-            qual1[i]=0;
-            qual2[i]=0;
-            // set bases to N
-            if(i%2 == 1) {
-                seq1[i/2] &= 0xF0;
-                seq1[i/2] |= N4bits;
-                seq2[i/2] &= 0xF0;
-                seq2[i/2] |= N4bits;
-            } else {
-                seq1[i/2] &= 0x0F;
-                seq1[i/2] |= (N4bits << 4);
-                seq2[i/2] &= 0x0F;
-                seq2[i/2] |= (N4bits << 4);
-            }
-        }
+    // compare 16 bases a word, only the words with mismatches are checked byte by byte
+    int bytes = len / 2;
+    int i = 0;
+    for(; i + 8 <= bytes; i += 8) {
+        uint64_t word1, word2;
+        memcpy(&word1, seq1 + i, 8);
+        memcpy(&word2, seq2 + i, 8);
+        if(word1 != word2)
+            diff += duplexMergeBytes(seq1, seq2, qual1, qual2, i, i + 8);
     }
+    diff += duplexMergeBytes(seq1, seq2, qual1, qual2, i, bytes);
+    // the last base of an odd length
+    if(len % 2 == 1)
+        diff += duplexMergeBase(seq1, seq2, qual1, qual2, len - 1);
     return diff;
 }
 
-bool Cluster::isDuplex(const string& umi1, const string& umi2) {
-    vector<string> umiPairs1;
-    vector<string> umiPairs2;
-    split(umi1, umiPairs1, "_");
-    split(umi2, umiPairs2, "_");
-    if(umiPairs1.size()!= 2 || umiPairs2.size() != 2)
-        return false;
-
-    if(umiPairs1[0] == umiPairs2[1] && umiPairs1[1] == umiPairs2[0])
-        return true;
-    else
-        return false;
+void Cluster::addRead(bam1_t* b) {
+    addRead(b, BamUtil::getReadInfo(b, mOptions->umiPrefix));
 }
 
-void Cluster::addRead(bam1_t* b) {
-    // left
-    string qname = BamUtil::getQName(b);
-    map<string, Pair*>::iterator iter = mPairs.find(qname);
+void Cluster::addRead(bam1_t* b, const BamReadInfo& info) {
+    int index = findPair(info.qnameHash, bam_get_qname(b));
 
-    if(iter!=mPairs.end()) {
-        iter->second->setRight(b);
+    if(index >= 0) {
+        mPairs[index]->setRight(b, info);
     }
     else {
-        Pair* p = new Pair(mOptions);
-        p->setLeft(b);
-        mPairs[qname]=p;
+        // left
+        Pair* p = new (&mArena) Pair(mOptions, &mArena);
+        p->setLeft(b, info);
+        insertPair(info.qnameHash, p);
+    }
+}
+
+// the original quadratic grouping, to check groupUMIs()
+static int groupUMIsNaive(const vector<PackedUMI>& umis, int threshold, vector<int>& groupOfUMIs) {
+    map<PackedUMI, int> umiCount;
+    for(int i=0; i<umis.size(); i++)
+        umiCount[umis[i]]++;
+    groupOfUMIs.assign(umis.size(), -1);
+    int groupNum = 0;
+    int remaining = umis.size();
+    while(remaining > 0) {
+        PackedUMI topUMI;
+        int topCount = 0;
+        map<PackedUMI, int>::iterator iter;
+        for(iter = umiCount.begin(); iter!=umiCount.end(); iter++) {
+            if(iter->second > topCount) {
+                topCount = iter->second;
+                topUMI = iter->first;
+            }
+        }
+        for(int i=0; i<umis.size(); i++) {
+            if(groupOfUMIs[i] < 0 && PackedUMI::diff(umis[i], topUMI) <= threshold) {
+                groupOfUMIs[i] = groupNum;
+                umiCount[umis[i]] = 0;
+                remaining--;
+            }
+        }
+        groupNum++;
     }
+    return groupNum;
+}
+
+static string randomUMI(int len) {
+    const char bases[4] = {'A', 'C', 'G', 'T'};
+    string umi(len, 'A');
+    for(int i=0; i<len; i++)
+        umi[i] = bases[rand() % 4];
+    return umi;
+}
+
+static bam1_t* makeNamedRead(const string& qname) {
+    bam1_t* b = bam_init1();
+    b->l_data = qname.length() + 1;
+    b->m_data = b->l_data;
+    b->data = (uint8_t*)malloc(b->m_data);
+    memcpy(b->data, qname.c_str(), b->l_data);
+    b->core.l_qname = b->l_data;
+    return b;
+}
+
+static bam1_t* makeSeqRead(const string& seq) {
+    bam1_t* b = makeNamedRead("r");
+    int len = seq.length();
+    b->l_data = b->m_data = b->core.l_qname + (len + 1) / 2 + len;
+    b->data = (uint8_t*)realloc(b->data, b->m_data);
+    b->core.l_qseq = len;
+    uint8_t* packed = bam_get_seq(b);
+    memset(packed, 0, (len + 1) / 2);
+    for(int i=0; i<len; i++)
+        packed[i/2] |= seq_nt16_table[(uint8_t)seq[i]] << ((~i & 1) << 2);
+    memset(bam_get_qual(b), 30, len);
+    return b;
 }
 
 bool Cluster::test(){
     bool passed = true;
-    passed &= umiDiff("ATCGATCG", "ATCGATCG") == 0;
-    passed &= umiDiff("ATCGATCG", "ATCGTTC") == 2;
-    passed &= umiDiff("ATCGATCG", "ATCGTTCG") == 1;
-    passed &= umiDiff("AAAA_ATCG", "AAAA_ATCG") == 0;
-    passed &= isDuplex("ATCG_CTAG", "CTAG_ATCG") == true;
-    passed &= isDuplex("AGC_TGA", "TGA_AGC") == true;
-    passed &= isDuplex("AAAA_AAAA", "AAAA_AAAA") == true;
-    passed &= isDuplex("CTAG", "CTAG_ATCG") == false;
-    passed &= isDuplex("CTAG", "CCCAGG") == false;
-    passed &= isDuplex("", "") == false;
+
+    // pair the reads by qname, large enough to use the slot table
+    Options opt;
+    Cluster c(&opt);
+    for(int i=0; i<40; i++)
+        c.addRead(makeNamedRead("read" + to_string(i)));
+    for(int i=39; i>=0; i--)
+        c.addRead(makeNamedRead("read" + to_string(i)));
+    passed &= c.mPairs.size() == 40;
+    for(int i=0; i<c.mPairs.size(); i++)
+        passed &= c.mPairs[i]->mLeft && c.mPairs[i]->mRight && c.mPairs[i]->getQName() == BamUtil::getQName(c.mPairs[i]->mRight);
+
+    // small clusters with mixed UMI layouts
+    srand(1);
+    for(int t=0; t<200; t++) {
+        vector<PackedUMI> umis;
+        int num = 1 + rand() % 40;
+        for(int i=0; i<num; i++) {
+            string umi = randomUMI(3 + rand() % 2);
+            if(t % 2 == 0)
+                umi = umi.substr(0, 2) + "_" + umi.substr(2);
+            umis.push_back(PackedUMI::pack(umi));
+        }
+        int threshold = t % 3;
+        vector<int> groups, naiveGroups;
+        passed &= groupUMIs(umis, threshold, Options::UMIGreedy, groups) == groupUMIsNaive(umis, threshold, naiveGroups);
+        passed &= groups == naiveGroups;
+    }
+
+    // AAAA x10 -> AAAT x4 -> AATT x4, and CCCC x1
+    vector<PackedUMI> network;
+    const char* networkUMIs[] = {"AAAA", "AAAT", "AATT", "CCCC"};
+    int networkCounts[] = {10, 4, 4, 1};
+    for(int u=0; u<4; u++) {
+        for(int r=0; r<networkCounts[u]; r++)
+            network.push_back(PackedUMI::pack(networkUMIs[u]));
+    }
+    vector<int> networkGroups;
+    passed &= groupUMIs(network, 1, Options::UMIGreedy, networkGroups) == 3 && networkGroups[10] == 0 && networkGroups[14] == 1;
+    passed &= groupUMIs(network, 1, Options::UMIDirectional, networkGroups) == 3 && networkGroups[10] == 0 && networkGroups[14] == 1;
+    passed &= groupUMIs(network, 1, Options::UMICluster, networkGroups) == 2 && networkGroups[14] == 0 && networkGroups[18] == 1;
+    network.resize(16);
+    // AATT x2 now can be taken by AAAT x4 in directional mode
+    passed &= groupUMIs(network, 1, Options::UMIDirectional, networkGroups) == 1;
+
+    // 40-base UMIs are not packed, but grouped the same way
+    vector<PackedUMI> longUMIs;
+    for(int m=0; m<50; m++) {
+        string umi = randomUMI(40);
+        for(int r=0; r<4; r++) {
+            string read = umi;
+            if(r == 3)
+                read[rand() % read.length()] = randomUMI(1)[0];
+            longUMIs.push_back(PackedUMI::pack(read));
+        }
+    }
+    vector<int> longGroups, naiveLongGroups;
+    passed &= groupUMIs(longUMIs, 1, Options::UMIGreedy, longGroups) == groupUMIsNaive(longUMIs, 1, naiveLongGroups);
+    passed &= longGroups == naiveLongGroups && longGroups[0] == longGroups[3];
+
+    // 50k pairs at one coordinate: 5000 molecules with 10 reads each, and some UMIs with a sequencing error
+    vector<PackedUMI> umis;
+    for(int m=0; m<5000; m++) {
+        string umi = randomUMI(12);
+        for(int r=0; r<10; r++) {
+            string read = umi;
+            if(rand() % 20 == 0)
+                read[rand() % read.length()] = randomUMI(1)[0];
+            umis.push_back(PackedUMI::pack(read));
+        }
+    }
+    vector<int> groups, naiveGroups;
+    passed &= groupUMIs(umis, 1, Options::UMIGreedy, groups) == groupUMIsNaive(umis, 1, naiveGroups);
+    passed &= groups == naiveGroups;
+
+    // duplex merging: the mismatches in a word and in the tail, one in the byte after a masked one, and R compared as N
+    string seq1 = "ACGGTACGTACGTACGTACGTACGTACGTACGTAACGTAR";
+    string seq2 = "TCTGTACGTACGTACGTACGTACGTACGTACGTAACGTTNC";
+    bam1_t* b1 = makeSeqRead(seq1);
+    bam1_t* b2 = makeSeqRead(seq2);
+    passed &= c.duplexMergeBam(b1, b2) == 4;
+    for(int i=0; i<seq1.length(); i++) {
+        bool masked = (i == 0 || i == 2 || i == 38);
+        uint8_t expected1 = masked ? 15 : seq_nt16_table[(uint8_t)seq1[i]];
+        uint8_t expected2 = masked ? 15 : seq_nt16_table[(uint8_t)seq2[i]];
+        passed &= bam_seqi(bam_get_seq(b1), i) == expected1 && bam_seqi(bam_get_seq(b2), i) == expected2;
+        passed &= bam_get_qual(b1)[i] == (masked ? 0 : 30) && bam_get_qual(b2)[i] == (masked ? 0 : 30);
+    }
+    // the tail of the longer read is not compared
+    passed &= bam_seqi(bam_get_seq(b2), 40) == seq_nt16_table[(uint8_t)'C'] && bam_get_qual(b2)[40] == 30;
+    bam_destroy1(b1);
+    bam_destroy1(b2);
+
     return passed;
 }
\ No newline at end of file
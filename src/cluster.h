@@ -10,6 +10,7 @@
 #include <vector>
 #include <map>
 #include "stats.h"
+#include "arena.h"
 
 using namespace std;
 
@@ -21,8 +22,11 @@ public:
     void dump();
     void addPair(Pair* pair);
     void addRead(bam1_t* b);
+    // with the fields derived when b was read
+    void addRead(bam1_t* b, const BamReadInfo& info);
 
     bool matches(Pair* p);
+    // the returned pairs are allocated in the arena of this cluster, delete them before the cluster
     vector<Pair*> clusterByUMI(int umiDiffThreshold, Stats* preStats, Stats* postStats, bool crossContig);
 
 
@@ -33,17 +37,37 @@ public:
     int getTLEN(){return mPairs[0]->getTLEN();}
     Pair::MapType getMapType(){return mPairs[0]->getMapType();}
 
+    // group the UMIs, starting from the UMI with most reads, by method:
+    //   greedy: the UMI takes all the UMIs within threshold, then the next one...
+    //   directional: the UMI takes the UMIs within threshold with reads <= (its reads + 1) / 2, and so do they
+    //   cluster: the UMI takes its connected component of UMIs within threshold
+    // groupOfUMIs is set to the group of each UMI, and the groups are numbered in the order of creation
+    // return the number of groups
+    static int groupUMIs(const vector<PackedUMI>& umis, int threshold, Options::UMIMethod method, vector<int>& groupOfUMIs);
+
     static bool test();
 
 private:
-    static int umiDiff(const string& umi1, const string& umi2);
-    static bool isDuplex(const string& umi1, const string& umi2);
     int duplexMerge(Pair* p1, Pair* p2);
     int duplexMergeBam(bam1_t* b1, bam1_t* b2);
+    // return the index of the pair with this qname in mPairs, or -1 if not found
+    int findPair(uint64_t hash, const char* qname);
+    void insertPair(uint64_t hash, Pair* p);
+    void rebuildSlots(int size);
     
 public:
-    map<string, Pair*> mPairs;
+    // in the order of arrival
+    vector<Pair*> mPairs;
     Options* mOptions;
+
+private:
+    // the qname hash of each pair in mPairs
+    vector<uint64_t> mPairHashes;
+    // open addressing table of indexes to mPairs, -1 for empty slot
+    // it's only built for large clusters, small clusters are just scanned
+    vector<int> mSlots;
+    // the pairs and groups of this cluster and their score buffers, released with the cluster
+    Arena mArena;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "clusterindex.h"
+#include <algorithm>
+
+ClusterIndex::ClusterIndex(Options* opt){
+    mOptions = opt;
+    mCount = 0;
+    mSeq = 0;
+}
+
+ClusterIndex::~ClusterIndex(){
+    for(int w=0; w<mWindows.size(); w++) {
+        Window* win = mWindows[w];
+        for(int i=0; i<win->buckets.size(); i++) {
+            Bucket& bucket = win->buckets[i];
+            for(int j=0; j<bucket.clusters.size(); j++)
+                delete bucket.clusters[j].second;
+            delete bucket.index;
+        }
+        delete win;
+    }
+    mWindows.clear();
+}
+
+ClusterIndex::Window* ClusterIndex::getWindow(int tid, bool create) {
+    // for sorted stream, it's usually the last one
+    if(!mWindows.empty() && mWindows.back()->tid == tid)
+        return mWindows.back();
+
+    deque<Window*>::iterator iter;
+    for(iter = mWindows.begin(); iter != mWindows.end(); iter++) {
+        if((*iter)->tid == tid)
+            return *iter;
+        if((*iter)->tid > tid)
+            break;
+    }
+    if(!create)
+        return NULL;
+
+    Window* win = new Window();
+    win->tid = tid;
+    win->start = 0;
+    win->count = 0;
+    mWindows.insert(iter, win);
+    return win;
+}
+
+Cluster* ClusterIndex::get(int tid, int left, long right) {
+    Window* win = getWindow(tid, true);
+
+    if(win->buckets.empty()) {
+        win->start = left;
+        win->buckets.resize(1);
+    } else if(left < win->start) {
+        // usually happens when the left read of a pair was not seen
+        int gap = win->start - left;
+        win->buckets.insert(win->buckets.begin(), gap, Bucket());
+        win->start = left;
+    } else {
+        if(left - win->start >= win->buckets.size())
+            win->buckets.resize(left - win->start + 1);
+    }
+
+    Bucket& bucket = win->buckets[left - win->start];
+    int slot = findSlot(bucket, right);
+    if(slot >= 0)
+        return bucket.clusters[slot].second;
+
+    Cluster* c = new Cluster(mOptions);
+    slot = bucket.clusters.size();
+    bucket.clusters.push_back(make_pair(right, c));
+    bucket.count++;
+    if(bucket.index) {
+        (*bucket.index)[right] = slot;
+    } else if(bucket.clusters.size() >= BUCKET_INDEX_MIN) {
+        bucket.index = new unordered_map<long, int>();
+        for(int i=0; i<bucket.clusters.size(); i++) {
+            if(bucket.clusters[i].second)
+                (*bucket.index)[bucket.clusters[i].first] = i;
+        }
+    }
+    win->count++;
+    mCount++;
+
+    Finish f;
+    f.tid = tid;
+    // cross-contig clusters are keyed by negative right, they are finished after the left
+    f.pos = right < 0 ? left : max((long)left, right);
+    f.seq = mSeq++;
+    f.left = left;
+    f.right = right;
+    f.slot = slot;
+    f.cluster = c;
+    mFinishes.push(f);
+    return c;
+}
+
+int ClusterIndex::findSlot(Bucket& bucket, long right) {
+    if(bucket.index) {
+        unordered_map<long, int>::iterator iter = bucket.index->find(right);
+        return iter == bucket.index->end() ? -1 : iter->second;
+    }
+    for(int i=0; i<bucket.clusters.size(); i++) {
+        if(bucket.clusters[i].first == right && bucket.clusters[i].second)
+            return i;
+    }
+    return -1;
+}
+
+void ClusterIndex::remove(const Finish& f) {
+    Window* win = getWindow(f.tid, false);
+    Bucket& bucket = win->buckets[f.left - win->start];
+    bucket.clusters[f.slot].second = NULL;
+    bucket.count--;
+    if(bucket.index)
+        bucket.index->erase(f.right);
+    win->count--;
+    mCount--;
+
+    // drop the empty buckets in the front, so that the first bucket always has clusters
+    while(!win->buckets.empty() && win->buckets.front().count == 0) {
+        delete win->buckets.front().index;
+        win->buckets.pop_front();
+        win->start++;
+    }
+    if(win->count == 0) {
+        mWindows.erase(find(mWindows.begin(), mWindows.end(), win));
+        delete win;
+    }
+}
+
+void ClusterIndex::take(vector<Finish>& finishes, vector<Cluster*>& clusters, vector<bool>& crossContigs) {
+    if(finishes.empty())
+        return;
+    sort(finishes.begin(), finishes.end(), [](const Finish& f1, const Finish& f2) {
+        if(f1.tid != f2.tid)
+            return f1.tid < f2.tid;
+        if(f1.left != f2.left)
+            return f1.left < f2.left;
+        return f1.seq < f2.seq;
+    });
+    for(int i=0; i<finishes.size(); i++) {
+        remove(finishes[i]);
+        clusters.push_back(finishes[i].cluster);
+        crossContigs.push_back(finishes[i].right < 0);
+    }
+}
+
+void ClusterIndex::retire(int tid, int pos, vector<Cluster*>& clusters, vector<bool>& crossContigs) {
+    vector<Finish> finishes;
+    while(!mFinishes.empty()) {
+        const Finish& f = mFinishes.top();
+        if(f.tid > tid || (f.tid == tid && f.pos >= pos))
+            break;
+        finishes.push_back(f);
+        mFinishes.pop();
+    }
+    take(finishes, clusters, crossContigs);
+}
+
+void ClusterIndex::retireAll(vector<Cluster*>& clusters, vector<bool>& crossContigs) {
+    vector<Finish> finishes;
+    while(!mFinishes.empty()) {
+        finishes.push_back(mFinishes.top());
+        mFinishes.pop();
+    }
+    take(finishes, clusters, crossContigs);
+}
+
+bool ClusterIndex::getFirst(int& tid, int& left) {
+    if(mWindows.empty())
+        return false;
+    tid = mWindows.front()->tid;
+    left = mWindows.front()->start;
+    return true;
+}
+
+bool ClusterIndex::empty() {
+    return mCount == 0;
+}
+
+long ClusterIndex::size() {
+    return mCount;
+}
+
+void ClusterIndex::dump() {
+    for(int w=0; w<mWindows.size(); w++) {
+        Window* win = mWindows[w];
+        for(int i=0; i<win->buckets.size(); i++) {
+            Bucket& bucket = win->buckets[i];
+            for(int j=0; j<bucket.clusters.size(); j++) {
+                if(bucket.clusters[j].second)
+                    bucket.clusters[j].second->dump();
+            }
+        }
+    }
+}
+
+bool ClusterIndex::test() {
+    Options opt;
+    ClusterIndex index(&opt);
+    bool passed = true;
+
+    Cluster* c1 = index.get(0, 100, 300);
+    passed &= index.get(0, 100, 300) == c1;
+    Cluster* c2 = index.get(0, 100, 250);
+    Cluster* c3 = index.get(0, 150, 200);
+    // cross-contig cluster
+    Cluster* c4 = index.get(0, 120, -5000);
+    // left read not seen
+    Cluster* c5 = index.get(0, 50, 400);
+    passed &= index.size() == 5;
+
+    int tid = -1, left = -1;
+    passed &= index.getFirst(tid, left) && tid == 0 && left == 50;
+
+    vector<Cluster*> clusters;
+    vector<bool> crossContigs;
+    index.retire(0, 121, clusters, crossContigs);
+    passed &= clusters.size() == 1 && clusters[0] == c4 && crossContigs[0];
+
+    clusters.clear();
+    crossContigs.clear();
+    index.retire(0, 260, clusters, crossContigs);
+    passed &= clusters.size() == 2 && clusters[0] == c2 && clusters[1] == c3;
+    passed &= index.getFirst(tid, left) && left == 50;
+
+    Cluster* c6 = index.get(1, 10, 100);
+    clusters.clear();
+    crossContigs.clear();
+    index.retire(1, 5, clusters, crossContigs);
+    passed &= clusters.size() == 2 && clusters[0] == c5 && clusters[1] == c1;
+    passed &= index.getFirst(tid, left) && tid == 1 && left == 10;
+
+    clusters.clear();
+    crossContigs.clear();
+    index.retireAll(clusters, crossContigs);
+    passed &= clusters.size() == 1 && clusters[0] == c6 && index.empty();
+    passed &= !index.getFirst(tid, left);
+
+    Cluster* all[] = {c1, c2, c3, c4, c5, c6};
+    for(int i=0; i<6; i++)
+        delete all[i];
+
+    // a bucket large enough to have a hash of the rights, with some clusters retired and created again
+    vector<Cluster*> many;
+    for(int i=0; i<BUCKET_INDEX_MIN * 2; i++)
+        many.push_back(index.get(2, 100, 200 + i));
+    for(int i=0; i<many.size(); i++)
+        passed &= index.get(2, 100, 200 + i) == many[i];
+    clusters.clear();
+    crossContigs.clear();
+    index.retire(2, 210, clusters, crossContigs);
+    passed &= clusters.size() == 10 && clusters[0] == many[0] && clusters[9] == many[9];
+    for(int i=0; i<clusters.size(); i++)
+        delete clusters[i];
+    // a retired right is a new cluster if it comes again
+    Cluster* again = index.get(2, 100, 205);
+    passed &= again != many[5] && index.get(2, 100, 205) == again && index.get(2, 100, 215) == many[15];
+    passed &= index.size() == BUCKET_INDEX_MIN * 2 - 10 + 1;
+    clusters.clear();
+    crossContigs.clear();
+    index.retireAll(clusters, crossContigs);
+    passed &= clusters.size() == BUCKET_INDEX_MIN * 2 - 10 + 1 && index.empty();
+    for(int i=0; i<clusters.size(); i++)
+        delete clusters[i];
+
+    if(!passed)
+        cerr << "ClusterIndex::test failed" << endl;
+    return passed;
+}
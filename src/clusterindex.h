@@ -0,0 +1,100 @@
+#ifndef CLUSTER_INDEX_H
+#define CLUSTER_INDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cluster.h"
+#include "options.h"
+#include <vector>
+#include <deque>
+#include <queue>
+#include <unordered_map>
+
+using namespace std;
+
+// The clusters of a coordinate sorted stream, indexed by tid:left:right
+// Each contig has a window of buckets, one bucket for one left position, and a bucket holds the few clusters starting there
+// A cluster is finished when the stream passes its right (or its left for cross-contig clusters),
+// the clusters are also kept in a min-heap by this position, so that the finished ones are found without scanning the others
+// A bucket is scanned to find a right, unless it has BUCKET_INDEX_MIN clusters or more, then it has a hash of the rights
+
+// usually a bucket has only a few clusters, which are found faster by scanning than hashing
+const int BUCKET_INDEX_MIN = 16;
+
+class ClusterIndex {
+public:
+    ClusterIndex(Options* opt);
+    ~ClusterIndex();
+
+    // get the cluster of tid:left:right, it will be created if it doesn't exist
+    Cluster* get(int tid, int left, long right);
+    // take out the clusters finished before tid:pos, in the order of tid:left and creation
+    void retire(int tid, int pos, vector<Cluster*>& clusters, vector<bool>& crossContigs);
+    // take out all the clusters
+    void retireAll(vector<Cluster*>& clusters, vector<bool>& crossContigs);
+    // get the smallest tid:left of the clusters, return false if there is no cluster
+    bool getFirst(int& tid, int& left);
+    bool empty();
+    long size();
+    void dump();
+
+    static bool test();
+
+private:
+    struct Bucket {
+        // (right, cluster), a removed cluster is set to NULL, so that the others keep their slots
+        vector<pair<long, Cluster*>> clusters;
+        int count;
+        // right -> slot in clusters, NULL unless there are BUCKET_INDEX_MIN clusters
+        unordered_map<long, int>* index;
+
+        Bucket() : count(0), index(NULL) {}
+    };
+
+    struct Window {
+        int tid;
+        // the left of buckets[0]
+        int start;
+        long count;
+        // empty for the positions without any cluster
+        deque<Bucket> buckets;
+    };
+
+    struct Finish {
+        int tid;
+        // the cluster is finished when the stream passes this position
+        long pos;
+        // the creation order
+        long seq;
+        int left;
+        long right;
+        // the slot in its bucket
+        int slot;
+        Cluster* cluster;
+
+        bool operator>(const Finish& other) const {
+            if(tid != other.tid)
+                return tid > other.tid;
+            if(pos != other.pos)
+                return pos > other.pos;
+            return seq > other.seq;
+        }
+    };
+
+    Window* getWindow(int tid, bool create);
+    // return the slot of the cluster with this right, or -1
+    static int findSlot(Bucket& bucket, long right);
+    // remove the popped clusters from their buckets and output them
+    void take(vector<Finish>& finishes, vector<Cluster*>& clusters, vector<bool>& crossContigs);
+    void remove(const Finish& f);
+
+private:
+    Options* mOptions;
+    // sorted by tid
+    deque<Window*> mWindows;
+    priority_queue<Finish, vector<Finish>, greater<Finish> > mFinishes;
+    long mCount;
+    long mSeq;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "columnvoter.h"
+#include <iostream>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOTE_X86
+#endif
+
+// the rows of mVotes
+const int VOTE_COUNT = 0;
+const int VOTE_SCORE = VOTE_CODE_NUM;
+const int VOTE_QUAL = VOTE_CODE_NUM * 2;
+const int VOTE_TOP_QUAL = VOTE_CODE_NUM * 3;
+const int VOTE_TOTAL_SCORE = VOTE_CODE_NUM * 4;
+const int VOTE_OTHER = VOTE_CODE_NUM * 4 + 1;
+const int VOTE_ROWS = VOTE_CODE_NUM * 4 + 2;
+
+// the reads are voted in chunks, so that the 16-bit sums of a chunk don't overflow
+const int VOTE_CHUNK = 128;
+
+static void voteScalar(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int reads, int stride, int32_t* votes) {
+    // the index in VOTE_CODES of each 4-bit code, -1 for other codes
+    static const int8_t codeIndex[16] = {-1, 0, 1, -1, 2, -1, -1, -1, 3, -1, -1, -1, -1, -1, -1, 4};
+    for(int r=0; r<reads; r++) {
+        const uint8_t* b = bases + r * stride;
+        const uint8_t* q = quals + r * stride;
+        const int8_t* s = scores + r * stride;
+        for(int i=0; i<stride; i++) {
+            votes[VOTE_TOTAL_SCORE * stride + i] += s[i];
+            int c = codeIndex[b[i] & 0xF];
+            if(c < 0) {
+                votes[VOTE_OTHER * stride + i] = 1;
+                continue;
+            }
+            votes[(VOTE_COUNT + c) * stride + i]++;
+            votes[(VOTE_SCORE + c) * stride + i] += s[i];
+            votes[(VOTE_QUAL + c) * stride + i] += q[i];
+            if(q[i] > votes[(VOTE_TOP_QUAL + c) * stride + i])
+                votes[(VOTE_TOP_QUAL + c) * stride + i] = q[i];
+        }
+    }
+}
+
+#ifdef VOTE_X86
+// vote the codes [FIRST, FIRST + NUM) of 8 columns from i for the reads [r0, r1) with 16-bit lanes
+// the last pass also sums the total score and marks the other codes
+template<int FIRST, int NUM, bool LAST>
+__attribute__((target("sse4.1")))
+static inline void voteColumnsSSE41(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int r0, int r1, int stride, int i, int32_t* votes) {
+    __m128i count[NUM], score[NUM], qual[NUM], topQual[NUM];
+    for(int c=0; c<NUM; c++) {
+        count[c] = score[c] = qual[c] = topQual[c] = _mm_setzero_si128();
+    }
+    __m128i total = _mm_setzero_si128();
+    __m128i known = _mm_set1_epi16(-1);
+    for(int r=r0; r<r1; r++) {
+        int offset = r * stride + i;
+        __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(bases + offset)));
+        __m128i q = _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(quals + offset)));
+        __m128i s = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(scores + offset)));
+        for(int c=0; c<NUM; c++) {
+            // m is -1 for the matched lanes
+            __m128i m = _mm_cmpeq_epi16(b, _mm_set1_epi16(VOTE_CODES[FIRST + c]));
+            __m128i mq = _mm_and_si128(m, q);
+            count[c] = _mm_sub_epi16(count[c], m);
+            score[c] = _mm_add_epi16(score[c], _mm_and_si128(m, s));
+            qual[c] = _mm_add_epi16(qual[c], mq);
+            topQual[c] = _mm_max_epi16(topQual[c], mq);
+        }
+        if(LAST) {
+            total = _mm_add_epi16(total, s);
+            __m128i any = _mm_setzero_si128();
+            for(int c=0; c<VOTE_CODE_NUM; c++)
+                any = _mm_or_si128(any, _mm_cmpeq_epi16(b, _mm_set1_epi16(VOTE_CODES[c])));
+            known = _mm_and_si128(known, any);
+        }
+    }
+
+    // add the 16-bit sums to the 32-bit votes
+    #define FLUSH_SSE41(row, v, op) { \
+        __m128i* dst = (__m128i*)(votes + (row) * stride + i); \
+        _mm_storeu_si128(dst, op(_mm_loadu_si128(dst), _mm_cvtepi16_epi32(v))); \
+        _mm_storeu_si128(dst + 1, op(_mm_loadu_si128(dst + 1), _mm_cvtepi16_epi32(_mm_srli_si128(v, 8)))); }
+    for(int c=0; c<NUM; c++) {
+        FLUSH_SSE41(VOTE_COUNT + FIRST + c, count[c], _mm_add_epi32);
+        FLUSH_SSE41(VOTE_SCORE + FIRST + c, score[c], _mm_add_epi32);
+        FLUSH_SSE41(VOTE_QUAL + FIRST + c, qual[c], _mm_add_epi32);
+        FLUSH_SSE41(VOTE_TOP_QUAL + FIRST + c, topQual[c], _mm_max_epi32);
+    }
+    if(LAST) {
+        FLUSH_SSE41(VOTE_TOTAL_SCORE, total, _mm_add_epi32);
+        __m128i other = _mm_andnot_si128(known, _mm_set1_epi16(1));
+        FLUSH_SSE41(VOTE_OTHER, other, _mm_or_si128);
+    }
+    #undef FLUSH_SSE41
+}
+
+__attribute__((target("sse4.1")))
+static void voteSSE41(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int reads, int stride, int32_t* votes) {
+    for(int i=0; i<stride; i+=8) {
+        for(int r0=0; r0<reads; r0+=VOTE_CHUNK) {
+            int r1 = min(reads, r0 + VOTE_CHUNK);
+            // two passes to keep the sums in registers
+            voteColumnsSSE41<0, 3, false>(bases, quals, scores, r0, r1, stride, i, votes);
+            voteColumnsSSE41<3, 2, true>(bases, quals, scores, r0, r1, stride, i, votes);
+        }
+    }
+}
+
+// same as voteColumnsSSE41, but for 16 columns
+template<int FIRST, int NUM, bool LAST>
+__attribute__((target("avx2")))
+static inline void voteColumnsAVX2(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int r0, int r1, int stride, int i, int32_t* votes) {
+    __m256i count[NUM], score[NUM], qual[NUM], topQual[NUM];
+    for(int c=0; c<NUM; c++) {
+        count[c] = score[c] = qual[c] = topQual[c] = _mm256_setzero_si256();
+    }
+    __m256i total = _mm256_setzero_si256();
+    __m256i known = _mm256_set1_epi16(-1);
+    for(int r=r0; r<r1; r++) {
+        int offset = r * stride + i;
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(bases + offset)));
+        __m256i q = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(quals + offset)));
+        __m256i s = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*)(scores + offset)));
+        for(int c=0; c<NUM; c++) {
+            // m is -1 for the matched lanes
+            __m256i m = _mm256_cmpeq_epi16(b, _mm256_set1_epi16(VOTE_CODES[FIRST + c]));
+            __m256i mq = _mm256_and_si256(m, q);
+            count[c] = _mm256_sub_epi16(count[c], m);
+            score[c] = _mm256_add_epi16(score[c], _mm256_and_si256(m, s));
+            qual[c] = _mm256_add_epi16(qual[c], mq);
+            topQual[c] = _mm256_max_epi16(topQual[c], mq);
+        }
+        if(LAST) {
+            total = _mm256_add_epi16(total, s);
+            __m256i any = _mm256_setzero_si256();
+            for(int c=0; c<VOTE_CODE_NUM; c++)
+                any = _mm256_or_si256(any, _mm256_cmpeq_epi16(b, _mm256_set1_epi16(VOTE_CODES[c])));
+            known = _mm256_and_si256(known, any);
+        }
+    }
+
+    // add the 16-bit sums to the 32-bit votes
+    #define FLUSH_AVX2(row, v, op) { \
+        __m256i* dst = (__m256i*)(votes + (row) * stride + i); \
+        _mm256_storeu_si256(dst, op(_mm256_loadu_si256(dst), _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v)))); \
+        _mm256_storeu_si256(dst + 1, op(_mm256_loadu_si256(dst + 1), _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1)))); }
+    for(int c=0; c<NUM; c++) {
+        FLUSH_AVX2(VOTE_COUNT + FIRST + c, count[c], _mm256_add_epi32);
+        FLUSH_AVX2(VOTE_SCORE + FIRST + c, score[c], _mm256_add_epi32);
+        FLUSH_AVX2(VOTE_QUAL + FIRST + c, qual[c], _mm256_add_epi32);
+        FLUSH_AVX2(VOTE_TOP_QUAL + FIRST + c, topQual[c], _mm256_max_epi32);
+    }
+    if(LAST) {
+        FLUSH_AVX2(VOTE_TOTAL_SCORE, total, _mm256_add_epi32);
+        __m256i other = _mm256_andnot_si256(known, _mm256_set1_epi16(1));
+        FLUSH_AVX2(VOTE_OTHER, other, _mm256_or_si256);
+    }
+    #undef FLUSH_AVX2
+}
+
+__attribute__((target("avx2")))
+static void voteAVX2(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int reads, int stride, int32_t* votes) {
+    for(int i=0; i<stride; i+=16) {
+        for(int r0=0; r0<reads; r0+=VOTE_CHUNK) {
+            int r1 = min(reads, r0 + VOTE_CHUNK);
+            // two passes to keep the sums in registers
+            voteColumnsAVX2<0, 3, false>(bases, quals, scores, r0, r1, stride, i, votes);
+            voteColumnsAVX2<3, 2, true>(bases, quals, scores, r0, r1, stride, i, votes);
+        }
+    }
+}
+#endif
+
+VoteKernel ColumnVoter::selectKernel() {
+#ifdef VOTE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return voteAVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return voteSSE41;
+#endif
+    return voteScalar;
+}
+
+// the buffers are kept by each thread, since a large group would otherwise get fresh pages for every consensus
+struct VoterBuffers {
+    vector<uint8_t> bases;
+    vector<uint8_t> quals;
+    vector<int8_t> scores;
+    vector<int32_t> votes;
+};
+
+ColumnVoter::ColumnVoter(int len, int reads) {
+    // selected once for all
+    static VoteKernel kernel = selectKernel();
+    static thread_local VoterBuffers buffers;
+    mKernel = kernel;
+    mLen = len;
+    mReads = reads;
+    mStride = (len + VOTE_BLOCK - 1) / VOTE_BLOCK * VOTE_BLOCK;
+    buffers.bases.assign(reads * mStride, 0);
+    buffers.quals.assign(reads * mStride, 0);
+    buffers.scores.assign(reads * mStride, 0);
+    buffers.votes.assign(VOTE_ROWS * mStride, 0);
+    mBases = buffers.bases.data();
+    mQuals = buffers.quals.data();
+    mScores = buffers.scores.data();
+    mVotes = buffers.votes.data();
+}
+
+void ColumnVoter::vote() {
+    mKernel(mBases, mQuals, mScores, mReads, mStride, mVotes);
+}
+
+bool ColumnVoter::hasOtherBase(int pos) {
+    return mVotes[VOTE_OTHER * mStride + pos] != 0;
+}
+
+void ColumnVoter::getVotes(int pos, int* counts, int* baseScores, int* quals, uint8_t* topQuals, int& totalScore) {
+    for(int c=0; c<VOTE_CODE_NUM; c++) {
+        uint8_t code = VOTE_CODES[c];
+        counts[code] = mVotes[(VOTE_COUNT + c) * mStride + pos];
+        baseScores[code] = mVotes[(VOTE_SCORE + c) * mStride + pos];
+        quals[code] = mVotes[(VOTE_QUAL + c) * mStride + pos];
+        topQuals[code] = mVotes[(VOTE_TOP_QUAL + c) * mStride + pos];
+    }
+    totalScore = mVotes[VOTE_TOTAL_SCORE * mStride + pos];
+}
+
+void ColumnVoter::unpackBases(const uint8_t* packed, int start, int len, uint8_t* bases) {
+    int i = 0;
+    // make the start even, then two bases a byte
+    if(start % 2 == 1 && len > 0) {
+        bases[0] = packed[start/2] & 0xF;
+        i = 1;
+    }
+    const uint8_t* data = packed + (start + i) / 2;
+#ifdef VOTE_X86
+    // SSE2 is always available on x86-64
+    const __m128i low = _mm_set1_epi8(0x0F);
+    for(; i + 32 <= len; i += 32) {
+        __m128i v = _mm_loadu_si128((const __m128i*)data);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+        __m128i lo = _mm_and_si128(v, low);
+        _mm_storeu_si128((__m128i*)(bases + i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*)(bases + i + 16), _mm_unpackhi_epi8(hi, lo));
+        data += 16;
+    }
+#endif
+    for(; i + 1 < len; i += 2) {
+        bases[i] = (*data >> 4) & 0xF;
+        bases[i+1] = *data & 0xF;
+        data++;
+    }
+    if(i < len)
+        bases[i] = (*data >> 4) & 0xF;
+}
+
+bool ColumnVoter::test() {
+    bool passed = true;
+
+    // unpacking from odd/even starts
+    uint8_t packed[40];
+    for(int i=0; i<40; i++)
+        packed[i] = (uint8_t)(i * 37 + 11);
+    for(int start=0; start<4; start++) {
+        for(int len=0; len<70; len++) {
+            uint8_t bases[80];
+            unpackBases(packed, start, len, bases);
+            for(int i=0; i<len; i++) {
+                int p = start + i;
+                uint8_t expected = p % 2 == 1 ? packed[p/2] & 0xF : packed[p/2] >> 4;
+                passed &= bases[i] == expected;
+            }
+        }
+    }
+
+    // all available kernels should vote the same as the scalar one
+    vector<VoteKernel> kernels;
+    kernels.push_back(voteScalar);
+#ifdef VOTE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1"))
+        kernels.push_back(voteSSE41);
+    if(__builtin_cpu_supports("avx2"))
+        kernels.push_back(voteAVX2);
+#endif
+    const uint8_t codes[8] = {1, 2, 4, 8, 15, 1, 2, 3};
+    int len = 45;
+    // more than a chunk
+    int reads = 300;
+    int stride = (len + VOTE_BLOCK - 1) / VOTE_BLOCK * VOTE_BLOCK;
+    vector<uint8_t> bases(reads * stride, 0), quals(reads * stride, 0);
+    vector<int8_t> scores(reads * stride, 0);
+    srand(7);
+    for(int r=0; r<reads; r++) {
+        for(int i=0; i<len; i++) {
+            bases[r * stride + i] = codes[rand() % 8];
+            quals[r * stride + i] = rand() % 256;
+            scores[r * stride + i] = rand() % 256 - 128;
+        }
+    }
+    vector<vector<int32_t>> results;
+    for(int k=0; k<kernels.size(); k++) {
+        vector<int32_t> votes(VOTE_ROWS * stride, 0);
+        kernels[k](bases.data(), quals.data(), scores.data(), reads, stride, votes.data());
+        results.push_back(votes);
+    }
+    for(int k=1; k<results.size(); k++)
+        passed &= results[k] == results[0];
+
+    if(!passed)
+        cerr << "ColumnVoter::test failed" << endl;
+    return passed;
+}
@@ -0,0 +1,61 @@
+#ifndef COLUMN_VOTER_H
+#define COLUMN_VOTER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+
+using namespace std;
+
+// the 4-bit codes that are voted in columns: A, C, G, T, N
+const int VOTE_CODE_NUM = 5;
+const uint8_t VOTE_CODES[VOTE_CODE_NUM] = {1, 2, 4, 8, 15};
+
+// the rows are padded to a multiple of this
+const int VOTE_BLOCK = 16;
+
+typedef void (*VoteKernel)(const uint8_t* bases, const uint8_t* quals, const int8_t* scores, int reads, int stride, int32_t* votes);
+
+// Votes of the reads of a group for every position
+// The reads are transposed to rows of unpacked 4-bit bases, qualities and scores,
+// then the columns are voted block by block with SIMD
+
+class ColumnVoter {
+public:
+    ColumnVoter(int len, int reads);
+
+    // the rows to be filled, they have getStride() elements and are initialized as 0
+    uint8_t* getBaseRow(int read) {return &mBases[read * mStride];}
+    uint8_t* getQualRow(int read) {return &mQuals[read * mStride];}
+    char* getScoreRow(int read) {return (char*)&mScores[read * mStride];}
+    int getStride() {return mStride;}
+
+    void vote();
+    // some read has a base other than A/C/G/T/N at pos, which is not voted
+    bool hasOtherBase(int pos);
+    // fill the A/C/G/T/N entries of the 16-entry arrays, the others are not touched
+    void getVotes(int pos, int* counts, int* baseScores, int* quals, uint8_t* topQuals, int& totalScore);
+
+    // unpack len 4-bit bases from the start of packed, high nibble first
+    static void unpackBases(const uint8_t* packed, int start, int len, uint8_t* bases);
+
+    static bool test();
+
+private:
+    static VoteKernel selectKernel();
+
+private:
+    int mLen;
+    int mReads;
+    int mStride;
+    // the rows are in buffers owned by the thread, so only one voter can be used at a time in a thread
+    uint8_t* mBases;
+    uint8_t* mQuals;
+    int8_t* mScores;
+    // rows of stride: count, score, qual and top qual of each code, then the total score and the other base flags
+    int32_t* mVotes;
+    VoteKernel mKernel;
+};
+
+#endif
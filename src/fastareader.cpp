@@ -103,28 +103,28 @@ void FastaReader::readNext()
     mCurrentID = header.substr(0, space);
 }
 
+// the bases are encoded like seq_nt16 of htslib: 1 for A, 2 for C, 4 for G, 8 for T and 15 for N or others
 unsigned char FastaReader::base2bits(char base) {
     if(base =='A') return 1;
-    else if(base =='T') return 2;
-    else if(base =='C') return 3;
+    else if(base =='C') return 2;
     else if(base =='G') return 4;
+    else if(base =='T') return 8;
     else
-        return 0; // N or others
+        return 15; // N or others
 }
 
 char FastaReader::bits2base(unsigned char bits) {
-    if(bits >= 5)
-        return 'N';
-    const char bases[5] ={'N', 'A', 'T', 'C', 'G'};
-    return bases[bits];
+    const char bases[16] ={'N', 'A', 'C', 'N', 'G', 'N', 'N', 'N', 'T', 'N', 'N', 'N', 'N', 'N', 'N', 'N'};
+    return bases[bits & 0x0F];
+}
+
+unsigned char FastaReader::get4bits(const unsigned char* refdata, int refpos) {
+    // same as bam_seqi()
+    return (refdata[refpos/2] >> ((~refpos & 1) << 2)) & 0x0F;
 }
 
 unsigned char FastaReader::getBase(const unsigned char* refdata, int refpos) {
-    char two4bits = refdata[refpos/2];
-    if(refpos % 2 ==0)
-        return bits2base(two4bits & 0x0F);
-    else
-        return bits2base( (two4bits & 0xF0) >> 4 );
+    return bits2base(get4bits(refdata, refpos));
 }
 
 string FastaReader::toString(const unsigned char* refdata, int pos, int len) {
@@ -135,18 +135,17 @@ string FastaReader::toString(const unsigned char* refdata, int pos, int len) {
     return str;
 }
 
-// encode two four bits base in one byte
+// encode two four bits base in one byte, the first base in the high bits like bam_get_seq()
 unsigned char* FastaReader::to4bits(const string & str) {
     size_t len = (str.length() + 1) / 2;
     unsigned char* data = new unsigned char[len];
     memset(data, 0, len);
     for(int i=0; i<str.length(); i++) {
-        char val = 0;
-        char bits = base2bits(str[i]);
+        unsigned char bits = base2bits(str[i]);
         if(i%2 == 0)
-            data[i/2] |= bits;
-        else
             data[i/2] |= (bits << 4);
+        else
+            data[i/2] |= bits;
     }
     return data;
 }
@@ -40,8 +40,11 @@ public:
 
     static unsigned char base2bits(char base);
     static char bits2base(unsigned char bits);
+    // the 4-bit code of a base, which can be compared with the bases of bam_get_seq() directly
+    static unsigned char get4bits(const unsigned char* refdata, int refpos);
     static unsigned char getBase(const unsigned char* refdata, int refpos);
     static string toString(const unsigned char* refdata, int pos, int len);
+    static unsigned char* to4bits(const string& str);
 
 
 public:
@@ -57,7 +60,6 @@ private:
     bool readLine();
     bool endOfLine(char c);
     void setFastaSequenceIdDescription();
-    unsigned char* to4bits(const string& str);
 
 private:
     string mFastaFile;
@@ -1,10 +1,23 @@
 #include "gencore.h"
 #include "bamutil.h"
+#include "bampool.h"
+#include "reference.h"
 #include "jsonreporter.h"
 #include "htmlreporter.h"
+#include "bamwriter.h"
+#include "bamreader.h"
+#include "tempfiles.h"
 #include <limits.h>
+#include <unistd.h>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
-Gencore::Gencore(Options *opt){
+// the finished clusters are made consensus reads in batches of this size per thread, when there are multiple threads
+const int CLUSTERS_PER_THREAD = 128;
+
+Gencore::Gencore(Options *opt) : mProperClusters(opt), mUnProperClusters(opt) {
     mOptions = opt;
     mBamHeader = NULL;
     mOutSam = NULL;
@@ -13,15 +26,32 @@ Gencore::Gencore(Options *opt){
     mPostStats = new Stats(opt);
     mPostStats->setPostStats(true);
     mOutSetCleared = false;
+    mOutSetBytes = 0;
+    mOutSetLimit = (long)mOptions->bufferLimit * 1024 * 1024;
+    mPeakOutSetBytes = 0;
+    mSpillRuns = NULL;
+    mSpilledRuns = 0;
     mProcessedTid = -1;
     mProcessedPos = -1;
     mProperClustersFinished = false;
+    mThreadPool = NULL;
+    mOutputId = 0;
+    mShardTid = -1;
+    mTailUmiDiffThreshold = mOptions->unproperReadsUmiDiffThreshold;
+    mReleasedTid = -1;
+    mWriter = NULL;
+    mWriteStats = NULL;
+    mHtsPool.pool = NULL;
+    mHtsPool.qsize = 0;
 }
 
 Gencore::~Gencore(){
     outputOutSet();
-    releaseClusters(mProperClusters);
-    releaseClusters(mUnProperClusters);
+    finishWriter();
+    if(mSpillRuns) {
+        delete mSpillRuns;
+        mSpillRuns = NULL;
+    }
     if(mBamHeader != NULL) {
         bam_hdr_destroy(mBamHeader);
         mBamHeader = NULL;
@@ -32,114 +62,134 @@ Gencore::~Gencore(){
             exit(-1);
         }
     }
+    // the pool is shared with the shards, only the main object owns it
+    if(mHtsPool.pool && mShardTid < 0) {
+        hts_tpool_destroy(mHtsPool.pool);
+        mHtsPool.pool = NULL;
+    }
     delete mPreStats;
     delete mPostStats;
+    if(mThreadPool) {
+        delete mThreadPool;
+        mThreadPool = NULL;
+    }
 }
 
 void Gencore::report() {
     JsonReporter jsonreporter(mOptions);
+    jsonreporter.setBufferStats(mSpilledRuns, mPeakOutSetBytes);
     jsonreporter.report(mPreStats, mPostStats);
     HtmlReporter htmlreporter(mOptions);
     htmlreporter.report(mPreStats, mPostStats);
 }
 
-void Gencore::releaseClusters(map<int, map<int, map<long, Cluster*>>>& clusters) {
-    map<int, map<int, map<long, Cluster*>>>::iterator iter1;
-    map<int, map<long, Cluster*>>::iterator iter2;
-    map<long, Cluster*>::iterator iter3;
-    for(iter1 = clusters.begin(); iter1 != clusters.end(); iter1++) {
-        for(iter2 = iter1->second.begin(); iter2 != iter1->second.end(); iter2++) {
-            for(iter3 = iter2->second.begin(); iter3 != iter2->second.end(); iter3++) {
-                delete iter3->second;
-            }
-        }
+void Gencore::outputOutSet() {
+    bool fromRuns = false;
+    const BamOrderKey* next = NULL;
+    while((next = nextBuffered(fromRuns)) != NULL) {
+        bam1_t* b = next->b;
+        removeBuffered(fromRuns);
+        writeBam(b);
     }
+    mOutSetCleared = true;
 }
 
-void Gencore::dumpClusters(map<int, map<int, map<long, Cluster*>>>& clusters) {
-    map<int, map<int, map<long, Cluster*>>>::iterator iter1;
-    map<int, map<long, Cluster*>>::iterator iter2;
-    map<long, Cluster*>::iterator iter3;
-    for(iter1 = clusters.begin(); iter1 != clusters.end(); iter1++) {
-        for(iter2 = iter1->second.begin(); iter2 != iter1->second.end(); iter2++) {
-            for(iter3 = iter2->second.begin(); iter3 != iter2->second.end(); iter3++) {
-                 iter3->second->dump();
-            }
+static long bamMemSize(const bam1_t* b) {
+    return sizeof(bam1_t) + b->m_data;
+}
+
+const BamOrderKey* Gencore::nextBuffered(bool& fromRuns) {
+    const BamOrderKey* next = NULL;
+    fromRuns = false;
+    if(!mOutQueue.empty())
+        next = &mOutQueue.top();
+    if(mSpillRuns && !mSpillRuns->empty()) {
+        if(next == NULL || mSpillRuns->top() < *next) {
+            next = &mSpillRuns->top();
+            fromRuns = true;
         }
     }
+    return next;
 }
 
-void Gencore::outputOutSet() {
-    set<bam1_t*, bamComp>::iterator iter;
-    for(iter = mOutSet.begin(); iter!=mOutSet.end(); iter++) {
-        writeBam(*iter);
-        // delete this bam
-        bam_destroy1(*iter);
+void Gencore::removeBuffered(bool fromRuns) {
+    if(fromRuns) {
+        mSpillRuns->pop();
+    } else {
+        mOutSetBytes -= bamMemSize(mOutQueue.top().b);
+        mOutQueue.pop();
     }
-    mOutSet.clear();
-    mOutSetCleared = true;
 }
 
-void Gencore::writeBam(bam1_t* b) {
-    static int lastTid = -1;
-    static int lastPos = -1;
-    static bool warnedUnordered = false;
-    //BamUtil::dump(b);
-    if(b->core.tid <lastTid || (b->core.tid == lastTid && b->core.pos <lastPos)) {
-        // skip the -1:-1, which means unmapped
-        if(b->core.tid >=0 && b->core.pos >= 0) {
-            if(!warnedUnordered) {
-                cerr << "WARNING: The output will be unordered!" << endl;
-                warnedUnordered = true;
-            }
-            /*cerr << "ERROR: the input is unsorted. Found " << b->core.tid << ":" << b->core.pos << " after " << lastTid << ":" << lastPos << endl;
-            cerr << "Please sort the input first." << endl << endl;
-            //BamUtil::dump(b);
-            cerr << "mProcessedTid: " << mProcessedTid << endl;
-            cerr << "mProcessedPos: " << mProcessedPos << endl;
-            //dumpClusters(mProperClusters);
-            exit(-1);*/
-        }
+// write the whole mOutQueue to a sorted run on disk
+void Gencore::spillOutSet() {
+    if(mSpillRuns == NULL) {
+        stringstream ss;
+        ss << "gencore." << getpid() << "." << mShardTid << ".spill";
+        mSpillRuns = new SpillRuns(mBamHeader, joinpath(mOptions->tmpDir, ss.str()), &mHtsPool);
     }
-    if(sam_write1(mOutSam, mBamHeader, b) <0) {
-        error_exit("Writing failed, exiting ...");
+    vector<bam1_t*> records;
+    records.reserve(mOutQueue.size());
+    while(!mOutQueue.empty()) {
+        records.push_back(mOutQueue.top().b);
+        mOutQueue.pop();
     }
-    lastTid = b->core.tid;
-    lastPos = b->core.pos;
+    mSpillRuns->spill(records);
+    for(int i=0; i<records.size(); i++)
+        BamPool::instance()->put(records[i]);
+    mOutSetBytes = 0;
+    mSpilledRuns++;
+}
 
-    mPostStats->addRead(b);
+void Gencore::writeBam(bam1_t* b) {
+    //BamUtil::dump(b);
+    mWriter->write(b);
+}
+
+// the records written by mWriter are counted in mWriteStats, which is merged when the writer is finished
+void Gencore::startWriter() {
+    mWriteStats = new Stats(mOptions);
+    mWriteStats->setPostStats(true);
+    mWriteStats->makeGenomeDepthBuf();
+    mWriteStats->makeBedStats(mPostStats->mBedStats);
+    mWriter = new BamWriter(mOutSam, mBamHeader, mWriteStats);
+}
+
+void Gencore::finishWriter() {
+    if(mWriter == NULL)
+        return;
+    mWriter->finish();
+    delete mWriter;
+    mWriter = NULL;
+    mPostStats->merge(mWriteStats);
+    delete mWriteStats;
+    mWriteStats = NULL;
 }
 
 void Gencore::outputBam(bam1_t* b, bool isLeft) {
-    pair<set<bam1_t*, bamComp>::iterator,bool> ret = mOutSet.insert(b);
-    //cerr << "inserting " << (b)->core.tid << ":" << (b)->core.pos << endl;
-    //cerr << "head " << (*mOutSet.begin())->core.tid << ":" << (*mOutSet.begin())->core.pos << endl;
-    //cerr << "tail " << (*mOutSet.rbegin())->core.tid << ":" << (*mOutSet.rbegin())->core.pos << endl;
-    // pointing to its next
-    if(ret.second == false) {
-        cerr << "OOPS, found two completely same reads" << endl;
-        BamUtil::dump(b);
-        BamUtil::dump(*ret.first);
-    }
-    set<bam1_t*, bamComp>::iterator insertpos = ret.first;
-    insertpos++;
+    b->id = mOutputId++;
+    BamOrderKey key(b);
+    mOutQueue.push(key);
+    mOutSetBytes += bamMemSize(b);
+    if(mOutSetBytes > mPeakOutSetBytes)
+        mPeakOutSetBytes = mOutSetBytes;
     // if it's left, clear the output set less than it
     if(isLeft) {
-        //BamUtil::dump(b);
-        set<bam1_t*, bamComp>::iterator iter;
-        // write those bam less than coming left bam
-        for(iter = mOutSet.begin(); iter!=insertpos; iter++) {
+        bool fromRuns = false;
+        const BamOrderKey* next = NULL;
+        // write those bam not greater than coming left bam, from both mOutQueue and the spilled runs
+        while((next = nextBuffered(fromRuns)) != NULL && !(key < *next)) {
+            bam1_t* nb = next->b;
             // break since the reads in mProperClusters are smaller than this one
-            if(mProcessedPos == -1 || (*iter)->core.tid>mProcessedTid || ((*iter)->core.tid == mProcessedTid && (*iter)->core.pos >= mProcessedPos)) {
+            if(mProcessedPos == -1 || nb->core.tid>mProcessedTid || (nb->core.tid == mProcessedTid && nb->core.pos >= mProcessedPos)) {
                 break;
             }
-            writeBam(*iter);
-            // delete this bam
-            bam_destroy1(*iter);
+            removeBuffered(fromRuns);
+            writeBam(nb);
         }
-        // clear it
-        mOutSet.erase(mOutSet.begin(), iter);
     }
+    if(mOutSetBytes > mOutSetLimit)
+        spillOutSet();
 }
 
 void Gencore::outputPair(Pair* p) {
@@ -154,11 +204,58 @@ void Gencore::outputPair(Pair* p) {
     }
     if(p->mRight) {
         outputBam(p->mRight, false);
-        // right bam will be put in the mOutSet, so make it NULL to avoid being deleted
+        // right bam will be put in the mOutQueue, so make it NULL to avoid being deleted
         p->mRight =  NULL;
     }
 }
 
+// make consensus reads for the finished clusters, and output them in the order of the clusters
+void Gencore::processClusters(vector<Cluster*>& clusters, vector<bool>& crossContigs, int umiDiffThreshold) {
+    int num = clusters.size();
+    if(mThreadPool == NULL || num <= 1) {
+        for(int c=0; c<num; c++) {
+            vector<Pair*> csPairs = clusters[c]->clusterByUMI(umiDiffThreshold, mPreStats, mPostStats, crossContigs[c]);
+            for(int i=0; i<csPairs.size(); i++) {
+                outputPair(csPairs[i]);
+                delete csPairs[i];
+            }
+            delete clusters[c];
+        }
+    } else {
+        // split the clusters to some continuous ranges, each task has its own stats to avoid locking
+        int tasks = min(num, mThreadPool->size() * 4);
+        vector<vector<Pair*>> results(num);
+        vector<Stats*> preStats(tasks);
+        vector<Stats*> postStats(tasks);
+        for(int t=0; t<tasks; t++) {
+            preStats[t] = new Stats(mOptions);
+            postStats[t] = new Stats(mOptions);
+        }
+        mThreadPool->run(tasks, [&](int t) {
+            int start = (long)num * t / tasks;
+            int end = (long)num * (t+1) / tasks;
+            for(int c=start; c<end; c++)
+                results[c] = clusters[c]->clusterByUMI(umiDiffThreshold, preStats[t], postStats[t], crossContigs[c]);
+        });
+        for(int t=0; t<tasks; t++) {
+            mPreStats->merge(preStats[t]);
+            mPostStats->merge(postStats[t]);
+            delete preStats[t];
+            delete postStats[t];
+        }
+        // the output stage is ordered, so the result is identical to single-threaded mode
+        for(int c=0; c<num; c++) {
+            for(int i=0; i<results[c].size(); i++) {
+                outputPair(results[c][i]);
+                delete results[c][i];
+            }
+            delete clusters[c];
+        }
+    }
+    clusters.clear();
+    crossContigs.clear();
+}
+
 void Gencore::consensus(){
     samFile *in;
     in = sam_open(mOptions->input.c_str(), "r");
@@ -169,13 +266,26 @@ void Gencore::consensus(){
 
     if(ends_with(mOptions->output, "sam"))
         mOutSam = sam_open(mOptions->output.c_str(), "w");
-    else 
-        mOutSam = sam_open(mOptions->output.c_str(), "wb");
+    else {
+        string mode = "wb" + to_string(mOptions->compression);
+        mOutSam = sam_open(mOptions->output.c_str(), mode.c_str());
+    }
     if (!mOutSam) {
         cerr << "ERROR: failed to open output " << mOptions->output << endl;
         exit(-1);
     }
 
+    // BGZF decompression and compression are done in the htslib thread pool
+    if(mOptions->ioThread > 0) {
+        mHtsPool.pool = hts_tpool_init(mOptions->ioThread);
+        if(!mHtsPool.pool) {
+            cerr << "ERROR: failed to create the I/O thread pool" << endl;
+            exit(-1);
+        }
+        hts_set_thread_pool(in, &mHtsPool);
+        hts_set_thread_pool(mOutSam, &mHtsPool);
+    }
+
     mBamHeader = sam_hdr_read(in);
     mOptions->bamHeader = mBamHeader;
     mPreStats->makeGenomeDepthBuf();
@@ -188,44 +298,62 @@ void Gencore::consensus(){
         exit(-1);
     }
     BamUtil::dumpHeader(mBamHeader);
+    Reference::instance(mOptions)->setBamHeader(mBamHeader);
 
     if (sam_hdr_write(mOutSam, mBamHeader) < 0) {
         cerr << "failed to write header" << endl;
         exit(-1);
     }
 
+    if(mOptions->thread > 1)
+        mThreadPool = new ThreadPool(mOptions->thread);
+
+    // with an index, the contigs can be processed independently
+    hts_idx_t* idx = NULL;
+    if(mThreadPool && BamUtil::hasIndex(mOptions->input))
+        idx = sam_index_load(in, mOptions->input.c_str());
+
+    if(idx) {
+        consensusByContig(in, idx);
+        hts_idx_destroy(idx);
+    } else {
+        startWriter();
+        processInput(in, NULL);
+        // all the records should be written and counted before the stats are reported
+        outputOutSet();
+        finishWriter();
+    }
+
+    sam_close(in);
+
+    cerr << "----Before gencore processing:" << endl;
+    mPreStats->print();
+
+    cerr << endl << "----After gencore processing:" << endl;
+    mPostStats->print();
+
+    report();
+}
+
+// read all the reads from in, or only the reads of itr if it's not NULL
+void Gencore::processInput(samFile* in, hts_itr_t* itr) {
+    // the records are decoded ahead in the reader thread, which also detects the UMI prefix
+    BamReader reader(in, mBamHeader, itr, mOptions);
+    BamReadInfo info;
     bam1_t *b = NULL;
-    b = bam_init1();
-    int r;
     int count = 0;
     int lastTid = -1;
     int lastPos = -1;
     bool hasPE = false;
-    bool isFirst = true;
-    while ((r = sam_read1(in, mBamHeader, b)) >= 0) {
-        // for the first read, check UMI prefix automatically
-        if(isFirst) {
-            if(mOptions->umiPrefix == "auto") {
-                string umi = BamUtil::getQName(b);
-                if(umi.find("umi_") != string::npos) 
-                    mOptions->umiPrefix = "umi";
-                else if(umi.find("UMI_") != string::npos)
-                    mOptions->umiPrefix = "UMI";
-                else
-                    mOptions->umiPrefix = "";
-
-                if(!mOptions->umiPrefix.empty())
-                    cerr << endl << "Detected UMI prefix: " << mOptions->umiPrefix << endl << endl;
-            }
-            isFirst = false;
-        }
+    while ((b = reader.next(info)) != NULL) {
         mPreStats->addRead(b);
         count++;
         if(count < 1000) {
             if(b->core.mtid >= 0)
                 hasPE = true;
         }
-        if(count == 1000 && hasPE == false) {
+        // a contig shard doesn't warn, the whole input has been checked
+        if(count == 1000 && hasPE == false && mShardTid < 0) {
             cerr << "WARNING: seems that the input data is single-end, gencore will not make consensus read and remove duplication for SE data since grouping by coordination will be inaccurate." << endl << endl;
         }
 
@@ -241,7 +369,7 @@ void Gencore::consensus(){
         }
         // for testing, we only process to some contig
         if(mOptions->maxContig>0 && b->core.tid>=mOptions->maxContig){
-            b = bam_init1();
+            BamPool::instance()->put(b);
             break;
         }
         // if debug flag is enabled, show which contig we are start to process
@@ -257,42 +385,198 @@ void Gencore::consensus(){
             if(!mOutSetCleared) {
                 if(!mProperClustersFinished) {
                     mProperClustersFinished = true;
-                    finishConsensus(mProperClusters);
+                    finishConsensus(mProperClusters, mTailUmiDiffThreshold);
                 }
                 outputOutSet();
             }
             //writeBam(b);
+            BamPool::instance()->put(b);
             continue;
         }
 
         // for secondary alignments, we just skip it
-        if(!BamUtil::isPrimary(b)) {
+        if(!info.primary) {
+            BamPool::instance()->put(b);
             continue;
         }
-        addToCluster(b);
-        b = bam_init1();
+        addToCluster(b, info);
     }
+    reader.stop();
 
     if(!mProperClustersFinished) {
         mProperClustersFinished = true;
-        finishConsensus(mProperClusters);
+        finishConsensus(mProperClusters, mTailUmiDiffThreshold);
     }
     
-    //finishConsensus(mUnProperClusters);
+    //finishConsensus(mUnProperClusters, mOptions->unproperReadsUmiDiffThreshold);
+}
 
-    bam_destroy1(b);
-    sam_close(in);
+// process each contig in its own shard, and concatenate the shard outputs in the order of the header
+void Gencore::consensusByContig(samFile* in, hts_idx_t* idx) {
+    // check the leading reads of the whole input, the shards don't do this
+    bam1_t *b = BamPool::instance()->get();
+    int count = 0;
+    bool hasPE = false;
+    while(count < 1000 && sam_read1(in, mBamHeader, b) >= 0) {
+        if(count == 0)
+            BamReader::detectUMIPrefix(b, mOptions);
+        if(b->core.mtid >= 0)
+            hasPE = true;
+        count++;
+    }
+    if(count == 1000 && hasPE == false) {
+        cerr << "WARNING: seems that the input data is single-end, gencore will not make consensus read and remove duplication for SE data since grouping by coordination will be inaccurate." << endl << endl;
+    }
+    if(mOptions->umiPrefix == "auto")
+        mOptions->umiPrefix = "";
 
-    cerr << "----Before gencore processing:" << endl;
-    mPreStats->print();
+    vector<int> contigs;
+    for(int tid=0; tid<mBamHeader->n_targets; tid++) {
+        if(mOptions->maxContig>0 && tid>=mOptions->maxContig)
+            break;
+        uint64_t mapped = 0;
+        uint64_t unmapped = 0;
+        // skip the contigs without any read if the index has this information
+        if(hts_idx_get_stat(idx, tid, &mapped, &unmapped) == 0 && mapped + unmapped == 0)
+            continue;
+        contigs.push_back(tid);
+    }
+    int num = contigs.size();
+    if(mOptions->debug)
+        cerr << "Processing " << num << " contigs in " << mThreadPool->size() << " threads" << endl;
+
+    // start the longest contigs first
+    vector<int> schedule;
+    for(int i=0; i<num; i++)
+        schedule.push_back(i);
+    stable_sort(schedule.begin(), schedule.end(), [&](int a, int b) {
+        return mBamHeader->target_len[contigs[a]] > mBamHeader->target_len[contigs[b]];
+    });
+
+    vector<Gencore*> shards(num, NULL);
+    vector<string> shardFiles(num);
+    vector<bool> shardDone(num, false);
+    mutex doneMutex;
+    condition_variable doneCV;
+    for(int i=0; i<num; i++) {
+        stringstream ss;
+        ss << "gencore." << getpid() << "." << contigs[i] << ".tmp.bam";
+        shardFiles[i] = joinpath(mOptions->tmpDir, ss.str());
+        TempFiles::instance()->add(shardFiles[i]);
+    }
 
-    cerr << endl << "----After gencore processing:" << endl;
-    mPostStats->print();
+    thread runner([&]{
+        mThreadPool->run(num, [&](int s) {
+            int i = schedule[s];
+            Gencore* shard = new Gencore(mOptions);
+            shard->mHtsPool = mHtsPool;
+            // the shards running at the same time share the memory limit
+            shard->mOutSetLimit = mOutSetLimit / mThreadPool->size();
+            // without sharding, the clusters of a contig are retired by the reads of the next one like any other,
+            // only the last contig is left to the end of the input
+            if(i < num - 1)
+                shard->mTailUmiDiffThreshold = mOptions->properReadsUmiDiffThreshold;
+            shard->consensusContig(contigs[i], idx, shardFiles[i], mPreStats->mBedStats);
+            lock_guard<mutex> lock(doneMutex);
+            shards[i] = shard;
+            shardDone[i] = true;
+            doneCV.notify_all();
+        });
+    });
+
+    // concatenate the outputs while other shards are still being processed, the records are counted by the shards already
+    BamWriter writer(mOutSam, mBamHeader, NULL);
+    for(int i=0; i<num; i++) {
+        {
+            unique_lock<mutex> lock(doneMutex);
+            doneCV.wait(lock, [&]{return shardDone[i];});
+        }
+        samFile* shardIn = sam_open(shardFiles[i].c_str(), "r");
+        if(!shardIn) {
+            cerr << "ERROR: failed to open temporary file " << shardFiles[i] << endl;
+            exit(-1);
+        }
+        if(mHtsPool.pool)
+            hts_set_thread_pool(shardIn, &mHtsPool);
+        bam_hdr_t* shardHeader = sam_hdr_read(shardIn);
+        while(sam_read1(shardIn, shardHeader, b) >= 0) {
+            writer.write(b);
+            b = BamPool::instance()->get();
+        }
+        bam_hdr_destroy(shardHeader);
+        sam_close(shardIn);
+        TempFiles::instance()->remove(shardFiles[i]);
+
+        mPreStats->merge(shards[i]->mPreStats);
+        mPostStats->merge(shards[i]->mPostStats);
+        mSpilledRuns += shards[i]->mSpilledRuns;
+        mPeakOutSetBytes = max(mPeakOutSetBytes, shards[i]->mPeakOutSetBytes);
+        delete shards[i];
+        shards[i] = NULL;
+    }
+    runner.join();
+    writer.finish();
+
+    // the unmapped reads are not in any shard, but they are counted
+    hts_itr_t* itr = sam_itr_queryi(idx, HTS_IDX_NOCOOR, 0, 0);
+    if(itr) {
+        while(sam_itr_next(in, itr, b) >= 0)
+            mPreStats->addRead(b);
+        hts_itr_destroy(itr);
+    }
+    BamPool::instance()->put(b);
+    mOutSetCleared = true;
+    mProperClustersFinished = true;
+}
 
-    report();
+// process the reads of one contig, and write the result to outFile
+void Gencore::consensusContig(int tid, hts_idx_t* idx, const string& outFile, Bed* bed) {
+    mShardTid = tid;
+    samFile *in = sam_open(mOptions->input.c_str(), "r");
+    if (!in) {
+        cerr << "ERROR: failed to open " << mOptions->input << endl;
+        exit(-1);
+    }
+    mBamHeader = sam_hdr_read(in);
+    // a temporary file, no need to compress it
+    mOutSam = sam_open(outFile.c_str(), "wb0");
+    if (!mOutSam) {
+        cerr << "ERROR: failed to open temporary file " << outFile << endl;
+        exit(-1);
+    }
+    if(mHtsPool.pool) {
+        hts_set_thread_pool(in, &mHtsPool);
+        hts_set_thread_pool(mOutSam, &mHtsPool);
+    }
+    if (sam_hdr_write(mOutSam, mBamHeader) < 0) {
+        cerr << "failed to write header" << endl;
+        exit(-1);
+    }
+    mPreStats->makeGenomeDepthBuf();
+    mPreStats->makeBedStats(bed);
+    mPostStats->makeGenomeDepthBuf();
+    mPostStats->makeBedStats(bed);
+    startWriter();
+
+    hts_itr_t* itr = sam_itr_queryi(idx, tid, 0, mBamHeader->target_len[tid]);
+    if(itr) {
+        processInput(in, itr);
+        hts_itr_destroy(itr);
+    }
+    sam_close(in);
+    // no other shard uses this contig
+    Reference::instance(mOptions)->release(tid);
+
+    outputOutSet();
+    finishWriter();
+    if (sam_close(mOutSam) < 0) {
+        cerr << "ERROR: failed to close " << outFile << endl;
+        exit(-1);
+    }
+    mOutSam = NULL;
 }
 
-void Gencore::addToProperCluster(bam1_t* b) {
+void Gencore::addToProperCluster(bam1_t* b, const BamReadInfo& info) {
     int tid = b->core.tid;
     int left = b->core.pos;
     long right;
@@ -312,128 +596,40 @@ void Gencore::addToProperCluster(bam1_t* b) {
         }
     }
 
-    createCluster(mProperClusters, tid, left, right);
-    mProperClusters[tid][left][right]->addRead(b);
+    mProperClusters.get(tid, left, right)->addRead(b, info);
 
-
-    static int tick = 0;
-    tick++;
-    if(tick % 10000 != 0)
+    // take out the clusters with right < processing pos as soon as this read passes them
+    mProperClusters.retire(tid, b->core.pos, mFinishedClusters, mFinishedCrossContigs);
+    if(mFinishedClusters.empty())
         return;
-
-    // make consensus merge
-    map<int, map<int, map<long, Cluster*>>>::iterator iter1;
-    map<int, map<long, Cluster*>>::iterator iter2;
-    map<long, Cluster*>::iterator iter3;
-    bool needBreak = false;
-    // to mark the smallest tid in the set
-    int curProcessedTid = INT_MAX;
-    int curProcessedPos = -1;
-    int processedPos;
-    for(iter1 = mProperClusters.begin(); iter1 != mProperClusters.end();) {
-        if(iter1->first > tid || needBreak) {
-            if(curProcessedTid > iter1->first) {
-                curProcessedTid = iter1->first;
-                curProcessedPos = processedPos;
-            }
-            break;
-        }
-        // to mark the smallest pos in this set
-        processedPos =mBamHeader->target_len[iter1->first];
-        for(iter2 = iter1->second.begin(); iter2 != iter1->second.end(); ) {
-            if(iter1->first == tid && iter2->first >= b->core.pos) {
-                if(processedPos > iter2->first)
-                    processedPos = iter2->first;
-                needBreak = true;
-                break;
-            }
-            for(iter3 = iter2->second.begin(); iter3 != iter2->second.end(); ) {
-                // only deal with the clusters with right < processing pos
-                if(iter1->first == tid && iter3->first >= b->core.pos) {
-                    break;
-                }
-                vector<Pair*> csPairs = iter3->second->clusterByUMI(mOptions->properReadsUmiDiffThreshold, mPreStats, mPostStats, iter3->first < 0);
-                for(int i=0; i<csPairs.size(); i++) {
-                    //csPairs[i]->dump();
-                    outputPair(csPairs[i]);
-                    delete csPairs[i];
-                }
-                // this tid:left:right is done
-                delete iter3->second;
-                iter3 = iter2->second.erase(iter3);
-            }
-            // this tid:left is done
-            if(iter2->second.size() == 0) {
-                iter2 = iter1->second.erase(iter2);
-            } else {
-                if(processedPos > iter2->first)
-                    processedPos = iter2->first;
-                iter2++;
-            }
-        }
-        // this tid is done
-        if(iter1->second.size() == 0) {
-            iter1 = mProperClusters.erase(iter1);
-            curProcessedPos = processedPos;
-        } else {
-            if(curProcessedTid > iter1->first) {
-                curProcessedTid = iter1->first;
-                curProcessedPos = processedPos;
-            }
-            iter1++;
-        }
+    // with multiple threads, they are collected to a batch large enough to run in parallel
+    if(mThreadPool && mFinishedClusters.size() < mThreadPool->size() * CLUSTERS_PER_THREAD)
+        return;
+    processClusters(mFinishedClusters, mFinishedCrossContigs, mOptions->properReadsUmiDiffThreshold);
+    // the clusters of the previous contigs are all processed, a shard only has its own contig
+    if(mShardTid < 0 && tid > mReleasedTid) {
+        Reference::instance(mOptions)->releaseBefore(tid);
+        mReleasedTid = tid;
     }
-    if(curProcessedTid != INT_MAX) {
-        mProcessedTid = curProcessedTid;
-        mProcessedPos = curProcessedPos;
+
+    // the reads before the first remaining cluster can be written
+    // it's only updated when no finished cluster is waiting, since their reads are not output yet
+    int firstTid, firstLeft;
+    if(mProperClusters.getFirst(firstTid, firstLeft)) {
+        mProcessedTid = firstTid;
+        mProcessedPos = firstLeft;
     }
 }
 
-void Gencore::finishConsensus(map<int, map<int, map<long, Cluster*>>>& clusters) {
-    // make consensus merge
-    map<int, map<int, map<long, Cluster*>>>::iterator iter1;
-    map<int, map<long, Cluster*>>::iterator iter2;
-    map<long, Cluster*>::iterator iter3;
-    for(iter1 = clusters.begin(); iter1 != clusters.end();) {
-        for(iter2 = iter1->second.begin(); iter2 != iter1->second.end(); ) {
-            for(iter3 = iter2->second.begin(); iter3 != iter2->second.end(); ) {
-                // for unmapped reads, we just store them
-                if(iter1->first < 0 || iter2->first < 0 ) {
-                    map<string, Pair*>::iterator iterOfPairs;
-                    for(iterOfPairs = iter3->second->mPairs.begin(); iterOfPairs!=iter3->second->mPairs.end(); iterOfPairs++) {
-                        //csPairs[i]->dump();
-                        outputPair(iterOfPairs->second);
-                        delete iterOfPairs->second;
-                    }
-                } else {
-                    vector<Pair*> csPairs = iter3->second->clusterByUMI(mOptions->unproperReadsUmiDiffThreshold, mPreStats, mPostStats, iter3->first < 0);
-                    for(int i=0; i<csPairs.size(); i++) {
-                        //csPairs[i]->dump();
-                        outputPair(csPairs[i]);
-                        delete csPairs[i];
-                    }
-                }
-                // this tid:left:right is done
-                delete iter3->second;
-                iter3 = iter2->second.erase(iter3);
-            }
-            // this tid:left is done
-            if(iter2->second.size() == 0) {
-                iter2 = iter1->second.erase(iter2);
-            } else {
-                iter2++;
-            }
-        }
-        // this tid is done
-        if(iter1->second.size() == 0) {
-            iter1 = clusters.erase(iter1);
-        } else {
-            iter1++;
-        }
-    }
+void Gencore::finishConsensus(ClusterIndex& clusters, int umiDiffThreshold) {
+    // the finished clusters waiting for a batch were retired by the stream, like the other proper clusters
+    processClusters(mFinishedClusters, mFinishedCrossContigs, mOptions->properReadsUmiDiffThreshold);
+    // make consensus merge for the remaining ones
+    clusters.retireAll(mFinishedClusters, mFinishedCrossContigs);
+    processClusters(mFinishedClusters, mFinishedCrossContigs, umiDiffThreshold);
 }
 
-void Gencore::addToUnProperCluster(bam1_t* b) {
+void Gencore::addToUnProperCluster(bam1_t* b, const BamReadInfo& info) {
     int tid = b->core.tid;
     int left = b->core.pos;
     long right = b->core.mpos;
@@ -442,36 +638,15 @@ void Gencore::addToUnProperCluster(bam1_t* b) {
         left = b->core.mpos;
         right = b->core.pos;
     }
-    createCluster(mUnProperClusters, tid, left, right);
-    mUnProperClusters[tid][left][right]->addRead(b);
-}
-
-void Gencore::createCluster(map<int, map<int, map<long, Cluster*>>>& clusters, int tid, int left, long right) {
-    map<int, map<int, map<long, Cluster*>>>::iterator iter1 = clusters.find(tid);
-
-    if(iter1 == clusters.end()) {
-        clusters[tid] = map<int, map<long, Cluster*>>();
-        clusters[tid][left] = map<long, Cluster*>();
-        clusters[tid][left][right] = new Cluster(mOptions);
-    } else {
-        map<int, map<long, Cluster*>>::iterator iter2  =iter1->second.find(left);
-        if(iter2 == iter1->second.end()) {
-            clusters[tid][left] = map<long, Cluster*>();
-            clusters[tid][left][right] = new Cluster(mOptions);
-        } else {
-            map<long, Cluster*>::iterator iter3 = iter2->second.find(right);
-            if(iter3 == iter2->second.end())
-                clusters[tid][left][right] = new Cluster(mOptions);
-        }
-    }
+    mUnProperClusters.get(tid, left, right)->addRead(b, info);
 }
 
-void Gencore::addToCluster(bam1_t* b) {
+void Gencore::addToCluster(bam1_t* b, const BamReadInfo& info) {
     // unproperly mapped
     if(b->core.tid < 0) {
         // actually this will never happen since it would be written directly if it's unmapped
-        addToUnProperCluster(b);
+        addToUnProperCluster(b, info);
     } else {
-        addToProperCluster(b);
+        addToProperCluster(b, info);
     }
 }
\ No newline at end of file
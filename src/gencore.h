@@ -7,45 +7,20 @@
 #include "htslib/sam.h"
 #include "options.h"
 #include "cluster.h"
+#include "clusterindex.h"
 #include "stats.h"
 #include "bed.h"
 #include "htslib/sam.h"
+#include "htslib/thread_pool.h"
 #include <map>
-#include <set>
+#include <queue>
 #include "bamutil.h"
+#include "threadpool.h"
+#include "spillruns.h"
+#include "bamwriter.h"
 
 using namespace std;
 
-struct bamComp{
-    bool operator()(const bam1_t* b1, const bam1_t* b2) const {
-        if(b1->core.tid >= 0) {        // b1 is mapped
-            if(b2->core.tid<0 )
-                return true;
-            else if(b2->core.tid >  b1->core.tid)
-                return true;
-            else if(b2->core.tid == b1->core.tid && b2->core.pos >  b1->core.pos)
-                return true;
-            else if(b2->core.tid == b1->core.tid && b2->core.pos == b1->core.pos && b2->core.mtid >  b1->core.mtid)
-                return true;
-            else if(b2->core.tid == b1->core.tid && b2->core.pos == b1->core.pos && b2->core.mtid == b1->core.mtid && b2->core.mpos >  b1->core.mpos)
-                return true;
-            else if(b2->core.tid == b1->core.tid && b2->core.pos == b1->core.pos && b2->core.mtid == b1->core.mtid && b2->core.mpos == b1->core.mpos) {
-                if(b2->core.isize > b1->core.isize)
-                    return true;
-                else if(b2->core.isize == b1->core.isize && (long)b2->data > (long)b1->data) return true;
-                else return false;
-            } else
-                return false;
-        } else {         // b1 is unmapped
-            if(b2->core.tid<0) { // both are unmapped
-                return (long)b2->data > (long)b1->data;
-            }
-            else
-                return false;
-        }
-    }
-};
-
 class Gencore {
 public:
     Gencore(Options *opt);
@@ -54,36 +29,67 @@ public:
     void consensus();
 
 private:
-	void releaseClusters(map<int, map<int, map<long, Cluster*>>>& clusters);
-	void dumpClusters(map<int, map<int, map<long, Cluster*>>>& clusters);
-	void addToCluster(bam1_t* b);
-	void addToProperCluster(bam1_t* b);
-	void addToUnProperCluster(bam1_t* b);
-	void createCluster(map<int, map<int, map<long, Cluster*>>>& clusters, int tid, int left, long right);
+	void addToCluster(bam1_t* b, const BamReadInfo& info);
+	void addToProperCluster(bam1_t* b, const BamReadInfo& info);
+	void addToUnProperCluster(bam1_t* b, const BamReadInfo& info);
     void outputPair(Pair* p);
+    void processInput(samFile* in, hts_itr_t* itr);
+    void consensusByContig(samFile* in, hts_idx_t* idx);
+    void consensusContig(int tid, hts_idx_t* idx, const string& outFile, Bed* bed);
+    void processClusters(vector<Cluster*>& clusters, vector<bool>& crossContigs, int umiDiffThreshold);
     bool outputBam(bam1_t* b);
-    void finishConsensus(map<int, map<int, map<long, Cluster*>>>& clusters);
+    void finishConsensus(ClusterIndex& clusters, int umiDiffThreshold);
     void report();
     void outputBam(bam1_t* b, bool isLeft);
     void outputOutSet();
+    // hand b over to mWriter, it's owned by the writer then
     void writeBam(bam1_t* b);
+    void startWriter();
+    void finishWriter();
+    // the smallest buffered record in mOutQueue and the spilled runs, NULL if there is none
+    const BamOrderKey* nextBuffered(bool& fromRuns);
+    void removeBuffered(bool fromRuns);
+    void spillOutSet();
 
 private:
     string mInput;
     string mOutput;
     Options *mOptions;
     // chrid:left:right
-    map<int, map<int, map<long, Cluster*>>> mProperClusters;
-    map<int, map<int, map<long, Cluster*>>> mUnProperClusters;
+    ClusterIndex mProperClusters;
+    ClusterIndex mUnProperClusters;
+    // the clusters taken out of mProperClusters, but not processed yet
+    vector<Cluster*> mFinishedClusters;
+    vector<bool> mFinishedCrossContigs;
     bam_hdr_t *mBamHeader;
     samFile* mOutSam;
     Stats* mPreStats;
     Stats* mPostStats;
-    set<bam1_t*, bamComp> mOutSet;
+    // the reorder buffer, a min-heap of the records waiting to be written in order
+    priority_queue<BamOrderKey, vector<BamOrderKey>, greater<BamOrderKey> > mOutQueue;
+    // the memory used by mOutQueue, it's spilled to mSpillRuns when it exceeds mOutSetLimit
+    long mOutSetBytes;
+    long mOutSetLimit;
+    long mPeakOutSetBytes;
+    SpillRuns* mSpillRuns;
+    long mSpilledRuns;
     bool mOutSetCleared;
     int mProcessedTid;
     int mProcessedPos;
     bool mProperClustersFinished;
+    ThreadPool* mThreadPool;
+    uint64_t mOutputId;
+    // the contig processed by this object, -1 means the whole input
+    int mShardTid;
+    // the UMI threshold of the proper clusters left at the end, the unproper one for the end of the whole input
+    int mTailUmiDiffThreshold;
+    // the reference contigs before it are released
+    int mReleasedTid;
+    // writes the records in its own thread, the written records are counted in mWriteStats
+    BamWriter* mWriter;
+    Stats* mWriteStats;
+    // htslib thread pool for BGZF, shared by the input, the output and the shards
+    htsThreadPool mHtsPool;
 };
 
 #endif
@@ -1,37 +1,69 @@
 #include "group.h"
+#include "columnvoter.h"
 #include "bamutil.h"
 #include "reference.h"
 #include <memory.h>
+#include <unordered_map>
 
-Group::Group(Options* opt){
+Group::Group(Options* opt, Arena* arena){
     mOptions = opt;
+    mArena = arena;
+    mFastPath = false;
 }
 
 Group::~Group(){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        delete iter->second;
+    for(int i=0; i<mPairs.size(); i++) {
+        delete mPairs[i];
     }
 }
 
+int Group::findPair(uint64_t hash, const char* qname) {
+    auto range = mPairIndex.equal_range(hash);
+    for(auto iter = range.first; iter != range.second; iter++) {
+        if(strcmp(mPairs[iter->second]->getQNameData(), qname) == 0)
+            return iter->second;
+    }
+    return -1;
+}
+
+void Group::insertPair(uint64_t hash, Pair* p) {
+    mPairIndex.insert(make_pair(hash, (int)mPairs.size()));
+    mPairs.push_back(p);
+}
+
 void Group::addPair(Pair* p){
-    string qname = p->getQName();
-    if(mPairs.count(qname)>0)
-        delete mPairs[qname];
-    mPairs[qname] = p;
+    bam1_t* b = p->mLeft ? p->mLeft : p->mRight;
+    uint64_t hash = b ? BamUtil::getQNameHash(b) : 0;
+    int index = findPair(hash, p->getQNameData());
+    if(index >= 0) {
+        delete mPairs[index];
+        mPairs[index] = p;
+    } else {
+        insertPair(hash, p);
+    }
+}
+
+void Group::sortPairs() {
+    sort(mPairs.begin(), mPairs.end(), [](Pair* p1, Pair* p2) {
+        return strcmp(p1->getQNameData(), p2->getQNameData()) < 0;
+    });
+    // the indexes are changed
+    mPairIndex.clear();
+    for(int i=0; i<mPairs.size(); i++) {
+        bam1_t* b = mPairs[i]->mLeft ? mPairs[i]->mLeft : mPairs[i]->mRight;
+        mPairIndex.insert(make_pair(b ? BamUtil::getQNameHash(b) : 0, i));
+    }
 }
 
 void Group::dump(){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        iter->second->dump();
+    for(int i=0; i<mPairs.size(); i++) {
+        mPairs[i]->dump();
     }
 }
 
 bool Group::matches(Pair* p){
-    map<string, Pair*>::iterator iter;
-    for(iter = mPairs.begin(); iter!=mPairs.end(); iter++) {
-        if(iter->second->isDupWith(p))
+    for(int i=0; i<mPairs.size(); i++) {
+        if(mPairs[i]->isDupWith(p))
             return true;
     }
     return false;
@@ -69,10 +101,17 @@ Pair* Group::consensusMerge(bool crossContig) {
     int leftDiff = 0;
     int rightDiff = 0;
 
+    // the reads are voted in qname order
+    sortPairs();
+
+    // cleared by consensusMergeBam if any side needs the full merging
+    mFastPath = true;
+
     // in this case, no need to make consensus
-    if(mPairs.size()==1 && mPairs.begin()->second->mRight == NULL) {
-        Pair* p = mPairs.begin()->second;
+    if(mPairs.size()==1 && mPairs[0]->mRight == NULL) {
+        Pair* p = mPairs[0];
         mPairs.clear();
+        mPairIndex.clear();
         return p;
     }
 
@@ -80,20 +119,20 @@ Pair* Group::consensusMerge(bool crossContig) {
     if(crossContig) {
         int curLen = 0;
 
-        map<string, Pair*>::iterator iter;
-        for(iter=mPairs.begin(); iter!=mPairs.end(); iter++) {
-            if(iter->second->mLeft == NULL)
+        for(int i=0; i<mPairs.size(); i++) {
+            bam1_t* b = mPairs[i]->mLeft;
+            if(b == NULL)
                 continue;
 
             if(nameToCopy == NULL) {
-                nameToCopy = iter->second->mLeft;
-                curLen = iter->second->mLeft->core.l_qname;
+                nameToCopy = b;
+                curLen = b->core.l_qname;
                 continue;
             }
 
-            if(iter->second->mLeft->core.l_qname < curLen || (iter->second->mLeft->core.l_qname == curLen && strcmp(bam_get_qname(iter->second->mLeft), bam_get_qname(nameToCopy)) <0 )) {
-                nameToCopy = iter->second->mLeft;
-                curLen = iter->second->mLeft->core.l_qname;
+            if(b->core.l_qname < curLen || (b->core.l_qname == curLen && strcmp(bam_get_qname(b), bam_get_qname(nameToCopy)) <0 )) {
+                nameToCopy = b;
+                curLen = b->core.l_qname;
             }
         }
     }
@@ -101,7 +140,7 @@ Pair* Group::consensusMerge(bool crossContig) {
     bam1_t* left = consensusMergeBam(true, leftDiff);
     bam1_t* right = consensusMergeBam(false, rightDiff);
 
-    Pair *p = new Pair(mOptions);
+    Pair *p = new (mArena) Pair(mOptions, mArena);
     p->mMergeReads = mPairs.size();
 
     // for cross-contig mapped reads, only left read is present
@@ -133,32 +172,86 @@ Pair* Group::consensusMerge(bool crossContig) {
     return p;
 }
 
-bam1_t* Group::consensusMergeBam(bool isLeft, int& diff) {
-    vector<Pair*> allPairs;
-    map<string, Pair*>::iterator iterOfPairs;
-    for(iterOfPairs = mPairs.begin(); iterOfPairs!=mPairs.end(); iterOfPairs++) {
-        allPairs.push_back(iterOfPairs->second);
+bool Group::hasIdenticalReads(bool isLeft) {
+    bam1_t* first = isLeft ? mPairs[0]->mLeft : mPairs[0]->mRight;
+    if(first == NULL)
+        return false;
+    uint64_t hash = isLeft ? mPairs[0]->getLeftSeqHash() : mPairs[0]->getRightSeqHash();
+    for(int i=1; i<mPairs.size(); i++) {
+        bam1_t* b = isLeft ? mPairs[i]->mLeft : mPairs[i]->mRight;
+        if(b == NULL)
+            return false;
+        uint64_t h = isLeft ? mPairs[i]->getLeftSeqHash() : mPairs[i]->getRightSeqHash();
+        if(h != hash || b->core.pos != first->core.pos || b->core.n_cigar != first->core.n_cigar || b->core.l_qseq != first->core.l_qseq)
+            return false;
+        // the hashes are equal, it's very likely to be identical
+        if(memcmp(bam_get_cigar(b), bam_get_cigar(first), b->core.n_cigar * sizeof(uint32_t)) != 0)
+            return false;
+        if(memcmp(bam_get_seq(b), bam_get_seq(first), (b->core.l_qseq + 1) / 2) != 0)
+            return false;
     }
-    if(mPairs.size() > mOptions->skipLowComplexityClusterThreshold) {
-        map<string, int> cigars;
-        bam1_t* firstRead = NULL;
-        for(iterOfPairs = mPairs.begin(); iterOfPairs!=mPairs.end(); iterOfPairs++) {
-            Pair* p = iterOfPairs->second;
-            bam1_t* b = p->mLeft;
-            if(!isLeft)
-                b = p->mRight;
-            if(b) {
-                string cigar = BamUtil::getCigar(b);
-                if(cigars.count(cigar) == 0)
-                    cigars[cigar] = 1;
-                else
-                    cigars[cigar]++;
-                if(!firstRead)
-                    firstRead = b;
+    return true;
+}
+
+bam1_t* Group::consensusMergeBam(bool isLeft, int& diff) {
+    vector<Pair*>& allPairs = mPairs;
+
+    // all the reads contain each other, the first one is taken as the template like below
+    // the low complexity check is not needed either, since they have only one CIGAR
+    if(hasIdenticalReads(isLeft)) {
+        vector<bam1_t *> reads;
+        vector<char *> scores;
+        for(int i=0; i<allPairs.size(); i++) {
+            if(isLeft) {
+                reads.push_back(allPairs[i]->mLeft);
+                scores.push_back(allPairs[i]->getLeftScore());
+            } else {
+                reads.push_back(allPairs[i]->mRight);
+                scores.push_back(allPairs[i]->getRightScore());
             }
         }
+        bam1_t* out = reads[0];
+        if(isLeft)
+            allPairs[0]->mLeft = NULL;
+        else
+            allPairs[0]->mRight = NULL;
+        diff = makeConsensus(reads, out, scores, true, true);
+        return out;
+    }
+
+    // isPartOf only depends on the CIGARs, so the reads are bucketed by CIGAR
+    // and the containment is computed between the distinct CIGARs
+    vector<bam1_t*> parts(allPairs.size(), NULL);
+    vector<int> cigarOf(allPairs.size(), -1);
+    // the first read of each distinct CIGAR
+    vector<bam1_t*> cigarReads;
+    unordered_map<string, int> cigarIds;
+    bam1_t* firstRead = NULL;
+    for(int i=0; i<allPairs.size(); i++) {
+        bam1_t* b = allPairs[i]->mLeft;
+        if(!isLeft)
+            b = allPairs[i]->mRight;
+        if(b == NULL)
+            continue;
+        parts[i] = b;
+        if(!firstRead) {
+            firstRead = b;
+            mFastPath = false;
+        }
+        string cigar((const char*)bam_get_cigar(b), b->core.n_cigar * sizeof(uint32_t));
+        unordered_map<string, int>::iterator iter = cigarIds.find(cigar);
+        if(iter == cigarIds.end()) {
+            cigarOf[i] = cigarReads.size();
+            cigarIds[cigar] = cigarReads.size();
+            cigarReads.push_back(b);
+        } else {
+            cigarOf[i] = iter->second;
+        }
+    }
+
+    if(mPairs.size() > mOptions->skipLowComplexityClusterThreshold) {
         // this is abnormal, usually due to mapping result of low complexity reads
-        if(cigars.size() > mPairs.size() * 0.1 && firstRead) {
+        if(cigarReads.size() > mPairs.size() * 0.1 && firstRead) {
             string seq = BamUtil::getSeq(firstRead);
             int diffNeighbor = 0;
             for(int i=0;i<seq.length()-1;i++) {
@@ -192,40 +285,58 @@ bam1_t* Group::consensusMergeBam(bool isLeft, int& diff) {
         if(leftAligned)
             leftReadMode = true;
     }
-    // first we get a read that is most contained by other reads
-    vector<int> containedByList(allPairs.size(), 0);
+
+    // the alignment shapes: reads with the same CIGAR, and the same right ref pos for right reads
+    vector<int> shapeOf(allPairs.size(), -1);
+    vector<int> shapeCigar;
+    vector<int> shapeRightRefPos;
+    vector<int> shapeCount;
+    unordered_map<uint64_t, int> shapeIds;
     for(int i=0; i<allPairs.size(); i++) {
-        bam1_t* part = NULL;
-        if(isLeft)
-            part = allPairs[i]->mLeft;
-        else
-            part = allPairs[i]->mRight;
-        if(part == NULL)
+        if(parts[i] == NULL)
             continue;
+        int rightRefPos = 0;
+        if(!isLeft)
+            rightRefPos = allPairs[i]->getRightEndPos();
+        uint64_t key = ((uint64_t)(uint32_t)rightRefPos << 32) | (uint32_t)cigarOf[i];
+        unordered_map<uint64_t, int>::iterator iter = shapeIds.find(key);
+        if(iter == shapeIds.end()) {
+            shapeOf[i] = shapeCount.size();
+            shapeIds[key] = shapeCount.size();
+            shapeCigar.push_back(cigarOf[i]);
+            shapeRightRefPos.push_back(rightRefPos);
+            shapeCount.push_back(1);
+        } else {
+            shapeOf[i] = iter->second;
+            shapeCount[iter->second]++;
+        }
+    }
 
-        int containedBy = 1;
+    // the containment between the CIGARs, -1 for not computed yet
+    int cigarNum = cigarReads.size();
+    vector<char> partOf(cigarNum * cigarNum, -1);
+    // how many reads contain the reads of a shape, including themselves, -1 for not computed yet
+    vector<int> shapeContainedBy(shapeCount.size(), -1);
 
-        for(int j=0; j<allPairs.size(); j++) {
-            if(i == j)
-                continue;
-            bam1_t* whole = NULL;
-            if(isLeft)
-                whole = allPairs[j]->mLeft;
-            else
-                whole = allPairs[j]->mRight;
-            if(whole == NULL)
-                continue;
+    // first we get a read that is most contained by other reads
+    vector<int> containedByList(allPairs.size(), 0);
+    for(int i=0; i<allPairs.size(); i++) {
+        if(parts[i] == NULL)
+            continue;
 
-            // if processing right reads, we should align by the right ref pos
-            if(!isLeft) {
-                if(BamUtil::getRightRefPos(part) != BamUtil::getRightRefPos(whole)) {
+        int shape = shapeOf[i];
+        if(shapeContainedBy[shape] < 0) {
+            int containedBy = 0;
+            for(int s=0; s<shapeCount.size(); s++) {
+                // if processing right reads, we should align by the right ref pos
+                if(shapeRightRefPos[s] != shapeRightRefPos[shape])
                     continue;
-                }
+                if(isCigarPartOf(partOf, cigarReads, shapeCigar[shape], shapeCigar[s], leftReadMode))
+                    containedBy += shapeCount[s];
             }
-
-            if( BamUtil::isPartOf(part, whole, leftReadMode))
-                containedBy++;
+            shapeContainedBy[shape] = containedBy;
         }
+        int containedBy = shapeContainedBy[shape];
 
         containedByList[i] = containedBy;
         if(mPairs.size() > mOptions->skipLowComplexityClusterThreshold && containedBy>=mPairs.size()/2) 
@@ -306,7 +417,7 @@ bam1_t* Group::consensusMergeBam(bool isLeft, int& diff) {
         if(read == NULL || score == NULL)
             continue;
 
-        if( BamUtil::isPartOf(out, read, leftReadMode)) {
+        if(isCigarPartOf(partOf, cigarReads, cigarOf[mostContainedById], cigarOf[j], leftReadMode)) {
             reads.push_back(read);
             scores.push_back(score);
         }
@@ -317,7 +428,17 @@ bam1_t* Group::consensusMergeBam(bool isLeft, int& diff) {
     return out;
 }
 
-int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& scores, bool isLeft) {
+bool Group::isCigarPartOf(vector<char>& partOf, vector<bam1_t*>& cigarReads, int part, int whole, bool isLeft) {
+    // a CIGAR is always part of itself
+    if(part == whole)
+        return true;
+    char& result = partOf[part * cigarReads.size() + whole];
+    if(result < 0)
+        result = BamUtil::isPartOf(cigarReads[part], cigarReads[whole], isLeft) ? 1 : 0;
+    return result == 1;
+}
+
+int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& scores, bool isLeft, bool identicalReads) {
     if(out == NULL)
         return 0;
 
@@ -359,37 +480,80 @@ int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& sc
         }
     }
 
+    // the reference offset of each position of out, computed in one pass of its CIGAR
+    static thread_local vector<int> refOffsets;
     const unsigned char* refdata = NULL;
-    if(out->core.isize != 0) {
-        refdata = Reference::instance(mOptions)->getData(out->core.tid, out->core.pos, BamUtil::getRefOffset(out, len-1) + 1);
+    if(out->core.isize != 0 && len > 0) {
+        BamUtil::getRefOffsets(out, refOffsets);
+        refdata = Reference::instance(mOptions)->getData(out->core.tid, out->core.pos, refOffsets[len-1] + 1);
         if(refdata == NULL && mOptions->debug)
             cerr << "ref data is NULL for " << out->core.tid << ":" << out->core.pos << endl;
     }
+    // the identical reads all vote for the base of out, only their scores and qualities are summed
+    static thread_local vector<int> sumScores, sumQuals;
+    static thread_local vector<uint8_t> maxQuals;
+    // transpose the reads to rows of unpacked bases, qualities and scores aligned to out
+    ColumnVoter voter(identicalReads ? 0 : len, identicalReads ? 0 : reads.size());
+    if(identicalReads) {
+        sumScores.assign(len, 0);
+        sumQuals.assign(len, 0);
+        maxQuals.assign(len, 0);
+        for(int r=0; r<reads.size(); r++) {
+            const char* s = scores[r];
+            const uint8_t* q = allqual[r];
+            for(int i=0; i<len; i++) {
+                sumScores[i] += s[i];
+                sumQuals[i] += q[i];
+                maxQuals[i] = max(maxQuals[i], q[i]);
+            }
+        }
+    } else {
+        for(int r=0; r<reads.size(); r++) {
+            int offset = 0;
+            if(!isLeft)
+                offset = lenDiff[r];
+            int start = max(0, -offset);
+            int end = min(len, reads[r]->core.l_qseq - offset);
+            if(end > start) {
+                ColumnVoter::unpackBases(alldata[r], start + offset, end - start, voter.getBaseRow(r) + start);
+                memcpy(voter.getQualRow(r) + start, allqual[r] + start + offset, end - start);
+                memcpy(voter.getScoreRow(r) + start, scores[r] + start + offset, end - start);
+            }
+        }
+        voter.vote();
+    }
+
     // loop all the position of out
     for(int i=0; i<len; i++) {
         int counts[16]={0};
         int baseScores[16]={0};
         int quals[16]={0};
         uint8_t topQuals[16] = {0};
-        int totalqual = 0;
         int totalScore = 0;
-        for(int r=0; r<reads.size(); r++) {
-            int readpos = i;
-            if(!isLeft)
-                readpos = i + lenDiff[r];
-            uint8_t base = 0;
-            uint8_t qual = allqual[r][readpos];
-            if(readpos%2 == 1)
-                base = alldata[r][readpos/2] & 0xF;
-            else
-                base = (alldata[r][readpos/2]>>4) & 0xF;
-            counts[base]++;
-            baseScores[base] += scores[r][readpos];
-            totalScore += scores[r][readpos];
-            quals[base] += qual;
-            totalqual += qual;
-            if(qual > topQuals[base])
-                topQuals[base] = qual;
+        // the base of all the reads if they are identical
+        uint8_t identicalBase = 0;
+        if(identicalReads) {
+            identicalBase = (i%2 == 1) ? outdata[i/2] & 0xF : (outdata[i/2]>>4) & 0xF;
+            counts[identicalBase] = reads.size();
+            baseScores[identicalBase] = sumScores[i];
+            quals[identicalBase] = sumQuals[i];
+            topQuals[identicalBase] = maxQuals[i];
+            totalScore = sumScores[i];
+        } else if(!voter.hasOtherBase(i)) {
+            voter.getVotes(i, counts, baseScores, quals, topQuals, totalScore);
+        } else {
+            // rare codes other than A/C/G/T/N
+            for(int r=0; r<reads.size(); r++) {
+                uint8_t base = voter.getBaseRow(r)[i];
+                uint8_t qual = voter.getQualRow(r)[i];
+                char score = voter.getScoreRow(r)[i];
+                counts[base]++;
+                baseScores[base] += score;
+                totalScore += score;
+                quals[base] += qual;
+                if(qual > topQuals[base])
+                    topQuals[base] = qual;
+            }
         }
         // get the best representive base at this position
         uint8_t topBase=0;
@@ -427,16 +591,17 @@ int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& sc
                 needToCheckRef = true;
         }
 
-        char refbase = 0;
+        // the reference is encoded like the reads, 0 if it's not A/C/G/T
+        uint8_t refbase4bit = 0;
         if(refdata) {
-            int refpos = BamUtil::getRefOffset(out, i);
+            int refpos = refOffsets[i];
             if(refpos >= 0) {
-                refbase = FastaReader::getBase(refdata, out->core.pos + refpos);
+                refbase4bit = FastaReader::get4bits(refdata, out->core.pos + refpos);
             }
         }
 
-        if(refbase!='A' && refbase!='T' && refbase!='C' && refbase!='G')
-            refbase = 0;
+        if(refbase4bit!=1 && refbase4bit!=2 && refbase4bit!=4 && refbase4bit!=8)
+            refbase4bit = 0;
 
         // the secondary base is a single base
         if(secNum ==1){
@@ -467,20 +632,17 @@ int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& sc
             needToCheckRef = true;
 
         // integrate reference if it's possible
-        if(needToCheckRef && refbase!=0) {
-            uint8_t refbase4bit = BamUtil::base2fourbits(refbase);
+        if(needToCheckRef && refbase4bit!=0) {
             // check if there is one high quality base consistent to ref
             char refBaseQual = 0;
-            for(int r=0; r<reads.size(); r++) {
-                int readpos = i;
-                if(!isLeft)
-                    readpos = i + lenDiff[r];
-                uint8_t base = 0;
-                uint8_t qual = allqual[r][readpos];
-                if(readpos%2 == 1)
-                    base = alldata[r][readpos/2] & 0xF;
-                else
-                    base = (alldata[r][readpos/2]>>4) & 0xF;
+            if(identicalReads && identicalBase == refbase4bit) {
+                refBaseQual = maxQuals[i];
+                if(maxQuals[i] >= mOptions->highQuality)
+                    topBase = refbase4bit;
+            }
+            for(int r=0; r<reads.size() && !identicalReads; r++) {
+                uint8_t base = voter.getBaseRow(r)[i];
+                uint8_t qual = voter.getQualRow(r)[i];
                 // found a ref-consistent base
                 if(base == refbase4bit) {
                     // record the highest quality score of ref-consistent base
@@ -514,8 +676,7 @@ int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& sc
                 outdata[i/2] = (outdata[i/2] & 0x0F) | (topBase << 4);
             diff++;
 
-            if(refbase!=0) {
-                uint8_t refbase4bit = BamUtil::base2fourbits(refbase);
+            if(refbase4bit!=0) {
                 if(outBase == refbase4bit) 
                     mismatchInc++;
                 else if(topBase == refbase4bit) 
@@ -579,22 +740,54 @@ int Group::makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& sc
 }
 
 void Group::addRead(bam1_t* b) {
-    // left
-    string qname = BamUtil::getQName(b);
-    map<string, Pair*>::iterator iter = mPairs.find(qname);
+    uint64_t hash = BamUtil::getQNameHash(b);
+    int index = findPair(hash, bam_get_qname(b));
 
-    if(iter!=mPairs.end()) {
-        iter->second->setRight(b);
+    if(index >= 0) {
+        mPairs[index]->setRight(b);
     }
     else {
-        Pair* p = new Pair(mOptions);
+        // left
+        Pair* p = new (mArena) Pair(mOptions, mArena);
         p->setLeft(b);
-        mPairs[qname]=p;
+        insertPair(hash, p);
     }
 }
 
+static bam1_t* makeNamedRead(const string& qname) {
+    bam1_t* b = bam_init1();
+    b->l_data = qname.length() + 1;
+    b->m_data = b->l_data;
+    b->data = (uint8_t*)malloc(b->m_data);
+    memcpy(b->data, qname.c_str(), b->l_data);
+    b->core.l_qname = b->l_data;
+    return b;
+}
+
 bool Group::test(){
     bool passed = true;
+
+    // pair the reads by qname, the pair added later replaces the one with the same qname, and they are sorted once
+    Options opt;
+    Group g(&opt);
+    for(int i=0; i<40; i++)
+        g.addRead(makeNamedRead("read" + to_string(i)));
+    for(int i=39; i>=0; i--)
+        g.addRead(makeNamedRead("read" + to_string(i)));
+    Pair* replacement = new Pair(&opt);
+    replacement->setLeft(makeNamedRead("read7"));
+    g.addPair(replacement);
+    g.sortPairs();
+    passed &= g.mPairs.size() == 40;
+    for(int i=0; i<g.mPairs.size(); i++) {
+        bool replaced = g.mPairs[i] == replacement;
+        passed &= g.mPairs[i]->mLeft && (replaced || g.mPairs[i]->mRight);
+        if(i > 0)
+            passed &= strcmp(g.mPairs[i-1]->getQNameData(), g.mPairs[i]->getQNameData()) < 0;
+    }
+    int index = g.findPair(BamUtil::getQNameHash(replacement->mLeft), "read7");
+    passed &= index >= 0 && g.mPairs[index] == replacement;
+
     passed &= umiDiff("ATCGATCG", "ATCGATCG") == 0;
     passed &= umiDiff("ATCGATCG", "ATCGTTC") == 2;
     passed &= umiDiff("ATCGATCG", "ATCGTTCG") == 1;
@@ -9,15 +9,22 @@
 #include "htslib/sam.h"
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "stats.h"
 
 using namespace std;
 
 class Group {
 public:
-    Group(Options* opt);
+    // the consensus pairs are allocated in arena if it's not NULL
+    Group(Options* opt, Arena* arena = NULL);
     ~Group();
 
+    static void* operator new(size_t size, Arena* arena) {return Arena::allocObject(size, arena);}
+    static void* operator new(size_t size) {return Arena::allocObject(size, NULL);}
+    static void operator delete(void* p, Arena* arena) {Arena::freeObject(p);}
+    static void operator delete(void* p) {Arena::freeObject(p);}
+
     void dump();
     void addPair(Pair* pair);
     void addRead(bam1_t* b);
@@ -25,7 +32,8 @@ public:
     bool matches(Pair* p);
     Pair* consensusMerge(bool crossContig);
     bam1_t* consensusMergeBam(bool isLeft, int& diff);
-    int makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& scores, bool isLeft);
+    // identicalReads: the reads have the same sequence as out, so the votes of each position are just summed
+    int makeConsensus(vector<bam1_t* >& reads, bam1_t* out, vector<char*>& scores, bool isLeft, bool identicalReads = false);
 
 
     int getLeftRef(){return mPairs[0]->getLeftRef();}
@@ -34,17 +42,32 @@ public:
     int getRightPos(){return mPairs[0]->getRightPos();}
     int getTLEN(){return mPairs[0]->getTLEN();}
     Pair::MapType getMapType(){return mPairs[0]->getMapType();}
-    string getUMI(){return mPairs[0]->getUMI();}
+    const PackedUMI& getUMI(){return mPairs[0]->getUMI();}
 
     static bool test();
 
 private:
     static int umiDiff(const string& umi1, const string& umi2);
     static bool isDuplex(const string& umi1, const string& umi2);
+    // isPartOf between the reads of two distinct CIGARs, cached in the cigarReads.size()^2 matrix partOf
+    static bool isCigarPartOf(vector<char>& partOf, vector<bam1_t*>& cigarReads, int part, int whole, bool isLeft);
+    // return the index in mPairs with this qname, or -1
+    int findPair(uint64_t hash, const char* qname);
+    void insertPair(uint64_t hash, Pair* p);
+    // sort mPairs by qname, done once before merging
+    void sortPairs();
+    // all the pairs have the read of this side, at the same position and with the same CIGAR and sequence
+    bool hasIdenticalReads(bool isLeft);
     
 public:
-    map<string, Pair*> mPairs;
+    // in adding order, and sorted by qname in consensusMerge
+    vector<Pair*> mPairs;
+    // qname hash -> indexes in mPairs
+    unordered_multimap<uint64_t, int> mPairIndex;
     Options* mOptions;
+    Arena* mArena;
+    // set by consensusMerge: it's a single read, or the reads of each side are identical, so there was no containment search or column voting
+    bool mFastPath;
 };
 
 #endif
\ No newline at end of file
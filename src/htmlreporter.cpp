@@ -69,6 +69,7 @@ void HtmlReporter::printSummary(ofstream& ofs,  Stats* preStats, Stats* postStat
     outputRow(ofs, "duplication rate:", to_string(preStats->getDupRate()));
     outputRow(ofs, "Single Stranded Consensus Sequence:", to_string(postStats->mSSCSNum));
     outputRow(ofs, "Duplex Consensus Sequence:", to_string(postStats->mDCSNum));
+    outputRow(ofs, "Groups with a single read or identical reads:", to_string(postStats->mFastPathGroups));
     ofs << "</table>\n";
     ofs << "</div>\n";
 
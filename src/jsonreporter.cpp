@@ -1,7 +1,15 @@
 #include "jsonreporter.h"
+#include "bampool.h"
 
 JsonReporter::JsonReporter(Options* opt){
     mOptions = opt;
+    mSpilledRuns = 0;
+    mPeakBufferBytes = 0;
+}
+
+void JsonReporter::setBufferStats(long spilledRuns, long peakBytes) {
+    mSpilledRuns = spilledRuns;
+    mPeakBufferBytes = peakBytes;
 }
 
 JsonReporter::~JsonReporter(){
@@ -18,7 +26,8 @@ void JsonReporter::report(Stats* preStats, Stats* postStats) {
     ofs << "\t\t\"mapping_rate\":" << preStats->getMappingRate() << "," << endl;
     ofs << "\t\t\"duplication_rate\":" << preStats->getDupRate() << "," << endl;
     ofs << "\t\t\"single_stranded_consensus_sequence\":" << postStats->mSSCSNum << "," << endl;
-    ofs << "\t\t\"duplex_consensus_sequence\":" << postStats->mDCSNum  << "";
+    ofs << "\t\t\"duplex_consensus_sequence\":" << postStats->mDCSNum  << "," << endl;
+    ofs << "\t\t\"fast_path_groups\":" << postStats->mFastPathGroups  << "";
     ofs << endl;
     ofs << "\t" << "}," << endl;
 
@@ -34,6 +43,16 @@ void JsonReporter::report(Stats* preStats, Stats* postStats) {
     ofs << endl;
     ofs << "\t" << "}," << endl;
 
+    ofs << "\t" << "\"bam_pool\": {" << endl;
+    ofs << "\t\t\"reused_records\": " << BamPool::instance()->getHits() << "," << endl;
+    ofs << "\t\t\"allocated_records\": " << BamPool::instance()->getMisses() << endl;
+    ofs << "\t" << "}," << endl;
+
+    ofs << "\t" << "\"output_buffer\": {" << endl;
+    ofs << "\t\t\"spilled_runs\": " << mSpilledRuns << "," << endl;
+    ofs << "\t\t\"peak_bytes\": " << mPeakBufferBytes << endl;
+    ofs << "\t" << "}," << endl;
+
     ofs << "\t\"command\": " << "\"" << command << "\"" << endl;
 
     ofs << "}";
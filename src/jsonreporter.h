@@ -18,9 +18,13 @@ public:
     ~JsonReporter();
 
     void report(Stats* preStats, Stats* postStats);
+    // the spilled runs and the peak memory of the output reorder buffer
+    void setBufferStats(long spilledRuns, long peakBytes);
 
 private:
     Options* mOptions;
+    long mSpilledRuns;
+    long mPeakBufferBytes;
 };
 
 
@@ -21,6 +21,20 @@ int main(int argc, char* argv[]){
         return 0;
     }
 
+    // gencore index-ref <ref.fa> [<ref.fa.gcref>]
+    if (argc >= 2 && strcmp(argv[1], "index-ref")==0){
+        if(argc < 3 || argc > 4) {
+            cerr << "usage: gencore index-ref <ref.fa> [<index file>, <ref.fa>" << GCREF_SUFFIX << " by default]" << endl;
+            return 1;
+        }
+        string fastaFile(argv[2]);
+        string indexFile = fastaFile + GCREF_SUFFIX;
+        if(argc == 4)
+            indexFile = argv[3];
+        Reference::index(fastaFile, indexFile);
+        return 0;
+    }
+
     if (argc == 2 && (strcmp(argv[1], "-v")==0 || strcmp(argv[1], "--version")==0)){
         cerr << "gencore " << VERSION_NUMBER << endl;
         return 0;
@@ -30,7 +44,7 @@ int main(int argc, char* argv[]){
     // input/output
     cmd.add<string>("in", 'i', "input sorted bam/sam file. STDIN will be read from if it's not specified", false, "-");
     cmd.add<string>("out", 'o', "output bam/sam file. STDOUT will be written to if it's not specified", false, "-");
-    cmd.add<string>("ref", 'r', "reference fasta file name (should be an uncompressed .fa/.fasta file)", true, "");
+    cmd.add<string>("ref", 'r', "reference fasta file name (should be an uncompressed .fa/.fasta file). If <ref>.gcref made by `gencore index-ref <ref>` exists, it will be mmapped instead of loading the fasta. Otherwise if <ref>.fai made by `samtools faidx` exists, each contig is loaded when it's used. A .gcref file can also be given directly", true, "");
     cmd.add<string>("bed", 'b', "bed file to specify the capturing region, none by default", false, "");
     cmd.add("duplex_only", 'x', "only output duplex consensus sequences, which means single stranded consensus sequences will be discarded.");
     cmd.add("no_duplex", 0, "don't merge single stranded consensus sequences to duplex consensus sequences.");
@@ -43,12 +57,20 @@ int main(int argc, char* argv[]){
     cmd.add<double>("ratio_threshold", 'a', "if the ratio of the major base in a cluster is less than <ratio_threshold>, it will be further compared to the reference. The valud should be 0.5~1.0, and the default value is 0.8", false, 0.8);
     cmd.add<int>("score_threshold", 'c', "if the score of the major base in a cluster is less than <score_threshold>, it will be further compared to the reference. The valud should be 1~20, and the default value is 6", false, 6);
     cmd.add<int>("umi_diff_threshold", 'd', "if two reads with identical mapping position have UMI difference <= <umi_diff_threshold>, then they will be merged to generate a consensus read. Default value is 1.", false, 1);
+    cmd.add<string>("umi_method", 0, "how the UMIs at the same mapping position are grouped. greedy: the UMI with most reads takes all UMIs within <umi_diff_threshold>, then the next one. directional: a UMI only takes the UMIs within <umi_diff_threshold> with no more than half of its reads, and so on. cluster: the UMIs connected within <umi_diff_threshold> are grouped. Default is greedy.", false, "greedy");
     cmd.add<int>("duplex_diff_threshold", 'D', "if the forward consensus and reverse consensus sequences have <= <duplex_diff_threshold> mismatches, then they will be merged to generate a duplex consensus sequence, otherwise will be discarded. Default value is 2.", false, 2);
     cmd.add<int>("high_qual", 0, "the threshold for a quality score to be considered as high quality. Default 30 means Q30.", false, 30);
     cmd.add<int>("moderate_qual", 0, "the threshold for a quality score to be considered as moderate quality. Default 20 means Q20.", false, 20);
     cmd.add<int>("low_qual", 0, "the threshold for a quality score to be considered as low quality. Default 15 means Q15.", false, 15);
     cmd.add<int>("coverage_sampling", 0, "the sampling rate for genome scale coverage statistics. Default 10000 means 1/10000.", false, 10000);
 
+    // threading
+    cmd.add<int>("thread", 'w', "worker thread number for making consensus reads. If the input has an index (.bai/.csi), the contigs are processed in parallel. The output is identical to single-threaded mode. Default 1 means single-threaded.", false, 1);
+    cmd.add<int>("io_thread", 0, "htslib thread number for BGZF decompression of input and compression of output. Default 0 means compressing/decompressing in the main thread.", false, 0);
+    cmd.add<int>("compression", 'z', "compression level for output BAM, 1~9. 1 is fastest, 9 is smallest, default is 6.", false, 6);
+    cmd.add<int>("buffer_limit", 0, "memory limit in MB for the reads waiting to be written in order. Beyond it, they are spilled to sorted temporary files in <tmp_dir> and merged back when writing. With --thread, it's shared by the contigs processed at the same time. Default 4096.", false, 4096);
+    cmd.add<string>("tmp_dir", 0, "the folder to store temporary files, the folder of output file by default.", false, "");
+
     // reporting
     cmd.add<string>("json", 'j', "the json format report file name", false, "gencore.json");
     cmd.add<string>("html", 'h', "the html format report file name", false, "gencore.html");
@@ -74,10 +96,16 @@ int main(int argc, char* argv[]){
     opt.lowQuality = cmd.get<int>("low_qual");
     opt.coverageStep = cmd.get<int>("coverage_sampling");
     opt.properReadsUmiDiffThreshold = cmd.get<int>("umi_diff_threshold");
+    opt.umiMethodName = cmd.get<string>("umi_method");
     opt.duplexMismatchThreshold = cmd.get<int>("duplex_diff_threshold");
     opt.debug = cmd.exist("debug");
     opt.duplexOnly = cmd.exist("duplex_only");
     opt.disableDuplex = cmd.exist("no_duplex");
+    opt.thread = cmd.get<int>("thread");
+    opt.tmpDir = cmd.get<string>("tmp_dir");
+    opt.ioThread = cmd.get<int>("io_thread");
+    opt.compression = cmd.get<int>("compression");
+    opt.bufferLimit = cmd.get<int>("buffer_limit");
     if(opt.duplexOnly && opt.disableDuplex) {
         error_exit("You cannot enable both duplex_only and no_duplex");
     }
@@ -11,6 +11,8 @@ Options::Options(){
     bamHeader = NULL;
     properReadsUmiDiffThreshold = 1;
     unproperReadsUmiDiffThreshold = 0;
+    umiMethodName = "greedy";
+    umiMethod = UMIGreedy;
     duplexMismatchThreshold = 2;
     debug = false;
     hasBedFile = false;
@@ -37,6 +39,27 @@ Options::Options(){
 
     duplexOnly = false;
     disableDuplex = false;
+
+    thread = 1;
+    tmpDir = "";
+    ioThread = 0;
+    compression = 6;
+    bufferLimit = 4096;
+
+    makeQualScores();
+}
+
+void Options::makeQualScores() {
+    for(int q=0; q<256; q++) {
+        if(highQuality <= q)
+            qualScores[q] = scoreOfNotOverlappedHighQual;
+        else if(moderateQuality <= q)
+            qualScores[q] = scoreOfNotOverlappedModerateQual;
+        else if(lowQuality <= q)
+            qualScores[q] = scoreOfNotOverlappedLowQual;
+        else
+            qualScores[q] = scoreOfNotOverlappedBadQual;
+    }
 }
 
 bool Options::validate() {
@@ -93,6 +116,16 @@ bool Options::validate() {
         error_exit("umi_diff_threshold cannot be negative");
     }
 
+    if(umiMethodName == "greedy") {
+        umiMethod = UMIGreedy;
+    } else if(umiMethodName == "directional") {
+        umiMethod = UMIDirectional;
+    } else if(umiMethodName == "cluster") {
+        umiMethod = UMICluster;
+    } else {
+        error_exit("umi_method should be greedy, directional or cluster");
+    }
+
     if(lowQuality > moderateQuality) {
         error_exit("low_qual cannot be greater than moderate_qual");
     }
@@ -107,5 +140,40 @@ bool Options::validate() {
         error_exit("duplex_diff_threshold cannot be less than 0, suggest 2.");
     }
 
+    // the temporary files are put in the folder of output by default
+    if(tmpDir.empty()) {
+        if(output.empty() || output == "-")
+            tmpDir = "./";
+        else
+            tmpDir = dirname(output);
+    }
+    if(!file_exists(tmpDir) || !is_directory(tmpDir)) {
+        error_exit("tmp_dir " + tmpDir + " is not a folder");
+    }
+
+    if(thread < 1) {
+        error_exit("thread cannot be less than 1");
+    } else if(thread > 256) {
+        error_exit("thread cannot be greater than 256");
+    }
+
+    if(ioThread < 0) {
+        error_exit("io_thread cannot be negative");
+    } else if(ioThread > 256) {
+        error_exit("io_thread cannot be greater than 256");
+    }
+
+    if(compression < 1) {
+        error_exit("compression cannot be less than 1");
+    } else if(compression > 9) {
+        error_exit("compression cannot be greater than 9");
+    }
+
+    if(bufferLimit < 16) {
+        error_exit("buffer_limit cannot be less than 16");
+    }
+
+    makeQualScores();
+
     return true;
 }
\ No newline at end of file
@@ -14,8 +14,12 @@ using namespace std;
 
 class Options{
 public:
+    enum UMIMethod{UMIGreedy, UMIDirectional, UMICluster};
+
     Options();
     bool validate();
+    // fill qualScores by the quality thresholds, it should be called again if they are changed
+    void makeQualScores();
 
 public:
     string input;
@@ -35,6 +39,9 @@ public:
 
     // thresholds
     int properReadsUmiDiffThreshold;
+    // greedy, directional or cluster, parsed to umiMethod by validate()
+    string umiMethodName;
+    UMIMethod umiMethod;
     int unproperReadsUmiDiffThreshold;
     int duplexMismatchThreshold;
     int clusterSizeReq;
@@ -49,6 +56,8 @@ public:
     char scoreOfNotOverlappedModerateQual;
     char scoreOfNotOverlappedLowQual;
     char scoreOfNotOverlappedBadQual;
+    // the score of each quality by the thresholds above
+    char qualScores[256];
 
     // threshold for skipping low complexity cluster
     int skipLowComplexityClusterThreshold;
@@ -58,6 +67,17 @@ public:
 
     bool duplexOnly;
     bool disableDuplex;
+
+    // worker threads for consensus
+    int thread;
+    // folder for temporary files
+    string tmpDir;
+    // htslib threads for BGZF decompression and compression
+    int ioThread;
+    // compression level of output BAM
+    int compression;
+    // memory limit in MB of the records waiting to be written in order, they are spilled to tmpDir beyond it
+    int bufferLimit;
 };
 
 #endif
\ No newline at end of file
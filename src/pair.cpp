@@ -1,8 +1,99 @@
 #include "pair.h"
+#include "bampool.h"
 #include "bamutil.h"
+#include "columnvoter.h"
 #include <memory.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OVERLAP_X86
+#endif
+
+typedef void (*OverlapKernel)(const uint8_t* lbases, const uint8_t* rbases, uint8_t* lqual, uint8_t* rqual, int len, const Options* opt, char* lscores, char* rscores);
+
+// score the overlapped bases of a pair, which are unpacked to lbases and rbases
+// matched bases get the score of their mean quality + 4
+// for mismatched bases, the one with the lower quality gets 0, the other gets the score of the quality difference - 3,
+// and the quality of each is adjusted to max(0, this_qual - pair_qual)
+static void scoreOverlapScalar(const uint8_t* lbases, const uint8_t* rbases, uint8_t* lqual, uint8_t* rqual, int len, const Options* opt, char* lscores, char* rscores) {
+    const char* qualScores = opt->qualScores;
+    for(int i=0; i<len; i++) {
+        uint8_t lq = lqual[i];
+        uint8_t rq = rqual[i];
+        if(lbases[i] == rbases[i]) {
+            char score = qualScores[(lq + rq) / 2] + 4;
+            lscores[i] = score;
+            rscores[i] = score;
+        } else {
+            lqual[i] = lq > rq ? lq - rq : 0;
+            rqual[i] = rq > lq ? rq - lq : 0;
+            if(lq >= rq) {
+                lscores[i] = qualScores[lq - rq] - 3;
+                rscores[i] = 0;
+            } else {
+                lscores[i] = 0;
+                rscores[i] = qualScores[rq - lq] - 3;
+            }
+        }
+    }
+}
 
-Pair::Pair(Options* opt){
+#ifdef OVERLAP_X86
+// the same as scoreOverlapScalar, the scores are selected by comparing with the thresholds instead of looking up qualScores
+// the thresholds should be in [0, 255]
+__attribute__((target("sse4.1")))
+static void scoreOverlapSSE41(const uint8_t* lbases, const uint8_t* rbases, uint8_t* lqual, uint8_t* rqual, int len, const Options* opt, char* lscores, char* rscores) {
+    const __m128i high = _mm_set1_epi8((char)opt->highQuality);
+    const __m128i moderate = _mm_set1_epi8((char)opt->moderateQuality);
+    const __m128i low = _mm_set1_epi8((char)opt->lowQuality);
+    const __m128i highScore = _mm_set1_epi8(opt->scoreOfNotOverlappedHighQual);
+    const __m128i moderateScore = _mm_set1_epi8(opt->scoreOfNotOverlappedModerateQual);
+    const __m128i lowScore = _mm_set1_epi8(opt->scoreOfNotOverlappedLowQual);
+    const __m128i badScore = _mm_set1_epi8(opt->scoreOfNotOverlappedBadQual);
+    const __m128i one = _mm_set1_epi8(1);
+    int i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i lb = _mm_loadu_si128((const __m128i*)(lbases + i));
+        __m128i rb = _mm_loadu_si128((const __m128i*)(rbases + i));
+        __m128i lq = _mm_loadu_si128((const __m128i*)(lqual + i));
+        __m128i rq = _mm_loadu_si128((const __m128i*)(rqual + i));
+        __m128i match = _mm_cmpeq_epi8(lb, rb);
+        // (lq + rq) / 2, avg_epu8 rounds up
+        __m128i mean = _mm_sub_epi8(_mm_avg_epu8(lq, rq), _mm_and_si128(_mm_xor_si128(lq, rq), one));
+        __m128i ldiff = _mm_subs_epu8(lq, rq);
+        __m128i rdiff = _mm_subs_epu8(rq, lq);
+        // lq >= rq
+        __m128i leftHigher = _mm_cmpeq_epi8(_mm_max_epu8(lq, rq), lq);
+        __m128i q = _mm_blendv_epi8(_mm_or_si128(ldiff, rdiff), mean, match);
+        // the same order as Options::makeQualScores
+        __m128i score = badScore;
+        score = _mm_blendv_epi8(score, lowScore, _mm_cmpeq_epi8(_mm_max_epu8(q, low), q));
+        score = _mm_blendv_epi8(score, moderateScore, _mm_cmpeq_epi8(_mm_max_epu8(q, moderate), q));
+        score = _mm_blendv_epi8(score, highScore, _mm_cmpeq_epi8(_mm_max_epu8(q, high), q));
+        __m128i matchScore = _mm_add_epi8(score, _mm_set1_epi8(4));
+        __m128i mismatchScore = _mm_sub_epi8(score, _mm_set1_epi8(3));
+        __m128i ls = _mm_blendv_epi8(_mm_and_si128(leftHigher, mismatchScore), matchScore, match);
+        __m128i rs = _mm_blendv_epi8(_mm_andnot_si128(leftHigher, mismatchScore), matchScore, match);
+        _mm_storeu_si128((__m128i*)(lscores + i), ls);
+        _mm_storeu_si128((__m128i*)(rscores + i), rs);
+        _mm_storeu_si128((__m128i*)(lqual + i), _mm_blendv_epi8(ldiff, lq, match));
+        _mm_storeu_si128((__m128i*)(rqual + i), _mm_blendv_epi8(rdiff, rq, match));
+    }
+    scoreOverlapScalar(lbases + i, rbases + i, lqual + i, rqual + i, len - i, opt, lscores + i, rscores + i);
+}
+#endif
+
+static OverlapKernel selectOverlapKernel(const Options* opt) {
+#ifdef OVERLAP_X86
+    static bool sse41 = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.1"));
+    bool byteThresholds = opt->lowQuality >= 0 && opt->moderateQuality >= 0 && opt->highQuality >= 0
+        && opt->lowQuality <= 255 && opt->moderateQuality <= 255 && opt->highQuality <= 255;
+    if(sse41 && byteThresholds)
+        return scoreOverlapSSE41;
+#endif
+    return scoreOverlapScalar;
+}
+
+Pair::Pair(Options* opt, Arena* arena){
     mLeft = NULL;
     mRight = NULL;
     mLeftScore = NULL;
@@ -12,27 +103,31 @@ Pair::Pair(Options* opt){
     mMergeLeftDiff = 0;
     mMergeRightDiff = 0;
     mOptions = opt;
+    mArena = arena;
     mIsDuplex = false;
     mCssDcsTagWritten = false;
+    mLeftEndPos = -1;
+    mRightEndPos = -1;
+    mLeftSeqHash = 0;
+    mRightSeqHash = 0;
 }
 
 Pair::~Pair(){
     if(mLeft) {
-        bam_destroy1(mLeft);
+        BamPool::instance()->put(mLeft);
         mLeft = NULL;
     }
     if(mRight) {
-        bam_destroy1(mRight);
+        BamPool::instance()->put(mRight);
         mRight = NULL;
     }
-    if(mLeftScore) {
+    // the scores in the arena are released with it
+    if(mLeftScore && !mArena)
         delete[] mLeftScore;
-        mLeftScore = NULL;
-    }
-    if(mRightScore) {
+    if(mRightScore && !mArena)
         delete[] mRightScore;
-        mRightScore = NULL;
-    }
+    mLeftScore = NULL;
+    mRightScore = NULL;
 }
 
 void Pair::setDuplex(int mergeReadsOfReverseStrand) {
@@ -68,34 +163,22 @@ void Pair::writeSscsDcsTagBam(bam1_t* b) {
 }
 
 void Pair::assignNonOverlappedScores(uint8_t* qual, int start, int end, char* scores) {
-    for(int i=start;i<end;i++) {
-        uint8_t q = qual[i];
-        scores[i] = qual2score(q);
-    }
-}
-
-char Pair::qual2score(uint8_t q) {
-    if(mOptions->highQuality <= q)
-        return mOptions->scoreOfNotOverlappedHighQual;
-    else if(mOptions->moderateQuality <= q)
-        return mOptions->scoreOfNotOverlappedModerateQual;
-    else if(mOptions->lowQuality <= q)
-        return mOptions->scoreOfNotOverlappedLowQual;
-    else
-        return mOptions->scoreOfNotOverlappedBadQual;
+    const char* qualScores = mOptions->qualScores;
+    for(int i=start;i<end;i++)
+        scores[i] = qualScores[qual[i]];
 }
 
 void Pair::computeScore() {
     if(mLeft) {
         if(mLeftScore == NULL) {
-            mLeftScore = new char[mLeft->core.l_qseq];
+            mLeftScore = mArena ? (char*)mArena->alloc(mLeft->core.l_qseq) : new char[mLeft->core.l_qseq];
             memset(mLeftScore, mOptions->scoreOfNotOverlappedModerateQual, mLeft->core.l_qseq);
         }
     }
 
     if(mRight) {
         if(mRightScore == NULL) {
-            mRightScore = new char[mRight->core.l_qseq];
+            mRightScore = mArena ? (char*)mArena->alloc(mRight->core.l_qseq) : new char[mRight->core.l_qseq];
             memset(mRightScore, mOptions->scoreOfNotOverlappedModerateQual, mRight->core.l_qseq);
         }
     }
@@ -117,55 +200,21 @@ void Pair::computeScore() {
                 rightStart = rightMOffset - posDis;
                 cmpLen = min(leftMLen, rightMLen + posDis);
             }
-            uint8_t* lseq = bam_get_seq(mLeft);
-            uint8_t* rseq = bam_get_seq(mRight);
             uint8_t* lqual = bam_get_qual(mLeft);
             uint8_t* rqual = bam_get_qual(mRight);
-            if(mLeft) {
-                assignNonOverlappedScores(lqual, 0, min(mLeft->core.l_qseq, leftStart), mLeftScore);
-                assignNonOverlappedScores(lqual, max(0, leftStart+cmpLen), mLeft->core.l_qseq, mLeftScore);
-            }
-            if(mRight) {
-                assignNonOverlappedScores(rqual, 0, min(mRight->core.l_qseq, rightStart), mRightScore);
-                assignNonOverlappedScores(rqual, max(0, rightStart+cmpLen), mRight->core.l_qseq, mRightScore);
-            }
-            for(int i=0; i<cmpLen; i++) {
-                int l = leftStart + i;
-                int r = rightStart + i;
-                uint8_t lbase, rbase;
-                uint8_t lq = lqual[l];
-                uint8_t rq = rqual[r];
-
-                if(l%2 == 1)
-                    lbase = lseq[l/2] & 0xF;
-                else
-                    lbase = (lseq[l/2]>>4) & 0xF;
-                if(r%2 == 1)
-                    rbase = rseq[r/2] & 0xF;
-                else
-                    rbase = (rseq[r/2]>>4) & 0xF;
-
-                // matched pair, score += 4
-                if(lbase == rbase) {
-                    uint8_t q = (lq + rq) / 2;
-                    char score = qual2score(q) + 4;
-                    mLeftScore[l] = score;
-                    mRightScore[r] = score;
-                    continue;
-                } else {
-                    // modify the Q Scores since the bases are mismatched
-                    // In the overlapped region, if a base and its pair are mismatched, its quality score will be adjusted to: max(0, this_qual - pair_qual)
-                    lqual[l] = max(0, (int)lq - (int)rq);
-                    rqual[r] = max(0, (int)rq - (int)lq);
-                    uint8_t q = 0;
-                    if(lq >= rq ) {
-                        mLeftScore[l] = qual2score(lq - rq) - 3;
-                        mRightScore[r] = 0;
-                    } else {
-                        mLeftScore[l] = 0;
-                        mRightScore[r] = qual2score(rq - lq) -3;
-                    }
-                }
+            assignNonOverlappedScores(lqual, 0, min(mLeft->core.l_qseq, leftStart), mLeftScore);
+            assignNonOverlappedScores(lqual, max(0, leftStart+cmpLen), mLeft->core.l_qseq, mLeftScore);
+            assignNonOverlappedScores(rqual, 0, min(mRight->core.l_qseq, rightStart), mRightScore);
+            assignNonOverlappedScores(rqual, max(0, rightStart+cmpLen), mRight->core.l_qseq, mRightScore);
+            if(cmpLen > 0) {
+                // the overlapped bases are unpacked to bytes, then scored together
+                static thread_local vector<uint8_t> lbases, rbases;
+                lbases.resize(cmpLen);
+                rbases.resize(cmpLen);
+                ColumnVoter::unpackBases(bam_get_seq(mLeft), leftStart, cmpLen, lbases.data());
+                ColumnVoter::unpackBases(bam_get_seq(mRight), rightStart, cmpLen, rbases.data());
+                OverlapKernel kernel = selectOverlapKernel(mOptions);
+                kernel(lbases.data(), rbases.data(), lqual + leftStart, rqual + rightStart, cmpLen, mOptions, mLeftScore + leftStart, mRightScore + rightStart);
             }
         }
     }
@@ -186,18 +235,29 @@ char* Pair::getRightScore() {
 }
 
 void Pair::setLeft(bam1_t *b) {
+    setLeft(b, BamUtil::getReadInfo(b, mOptions->umiPrefix));
+}
+
+void Pair::setRight(bam1_t *b) {
+    setRight(b, BamUtil::getReadInfo(b, mOptions->umiPrefix));
+}
+
+void Pair::setLeft(bam1_t *b, const BamReadInfo& info) {
     if(mLeft)
-        bam_destroy1(mLeft);
+        BamPool::instance()->put(mLeft);
     mLeft = b;
-    mUMI = BamUtil::getUMI(mLeft, mOptions->umiPrefix);
-    mLeftCigar = BamUtil::getCigar(mLeft);
+    mUMI = info.umi;
+    mLeftEndPos = info.endPos;
+    mLeftSeqHash = info.seqHash;
 }
 
-void Pair::setRight(bam1_t *b) {
+void Pair::setRight(bam1_t *b, const BamReadInfo& info) {
     if(mRight)
-        bam_destroy1(mRight);
+        BamPool::instance()->put(mRight);
     mRight = b;
-    string umi = BamUtil::getUMI(mRight, mOptions->umiPrefix);
+    mRightEndPos = info.endPos;
+    mRightSeqHash = info.seqHash;
+    const PackedUMI& umi = info.umi;
     if(!mUMI.empty() && umi!=mUMI) {
         cerr << "Mismatched UMI of a pair of reads" << endl;
         if(mLeft) {
@@ -208,11 +268,10 @@ void Pair::setRight(bam1_t *b) {
             cerr << "Right:" << endl;
             BamUtil::dump(mRight);
         }
-        error_exit("The UMI of a read pair should be identical, but we got " + mUMI + " and " + umi );
+        error_exit("The UMI of a read pair should be identical, but we got " + mUMI.toString() + " and " + umi.toString() );
     }
     else
         mUMI = umi;
-    mRightCigar = BamUtil::getCigar(mRight);
 }
 
 bool Pair::pairFound() {
@@ -265,6 +324,15 @@ string Pair::getQName() {
         return "";
 }
 
+const char* Pair::getQNameData() {
+    if(mLeft != NULL)
+        return bam_get_qname(mLeft);
+    else if(mRight != NULL)
+        return bam_get_qname(mRight);
+    else
+        return "";
+}
+
 Pair::MapType Pair::getMapType() {
     if(mLeft == NULL || mRight == NULL)
         return Unknown;
@@ -291,15 +359,7 @@ Pair::MapType Pair::getMapType() {
     return Unknown;
 }
 
-string Pair::getLeftCigar() {
-    return mLeftCigar;
-}
-
-string Pair::getRightCigar() {
-    return mRightCigar;
-}
-
-string Pair::getUMI() {
+const PackedUMI& Pair::getUMI() {
     return mUMI;
 }
 
@@ -314,12 +374,7 @@ bool Pair::isDupWith(Pair* other) {
     if(getLeftPos() != other->getLeftPos() || getRightPos() != other->getRightPos())
         return false;
 
-    int umiDiff = 0;
-    for(int i=0; i<mUMI.length() && i<other->mUMI.length(); i++) {
-        if(mUMI[i] != other->mUMI[i])
-            umiDiff++;
-    }
-    if(umiDiff>1)
+    if(PackedUMI::mismatches(mUMI, other->mUMI)>1)
         return false;
 
     return true;
@@ -337,3 +392,74 @@ void Pair::dump() {
     }
 }
 
+
+bool Pair::test() {
+    bool passed = true;
+    vector<OverlapKernel> kernels;
+    kernels.push_back(scoreOverlapScalar);
+#ifdef OVERLAP_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.1"))
+        kernels.push_back(scoreOverlapSSE41);
+#endif
+    Options opt;
+    const uint8_t codes[6] = {1, 2, 4, 8, 15, 3};
+    srand(11);
+    for(int round=0; round<2; round++) {
+        if(round == 1) {
+            // thresholds at the bounds of a byte
+            opt.lowQuality = 0;
+            opt.moderateQuality = 41;
+            opt.highQuality = 255;
+            opt.makeQualScores();
+        }
+        for(int start=0; start<2; start++) {
+            int len = 77;
+            // the packed bases from odd and even starts, with more matches than mismatches
+            vector<uint8_t> lseq(64, 0), rseq(64, 0);
+            vector<uint8_t> lqual(len), rqual(len);
+            for(int i=0; i<len; i++) {
+                int p = start + i;
+                uint8_t lb = codes[rand() % 6];
+                uint8_t rb = rand() % 4 == 0 ? codes[rand() % 6] : lb;
+                lseq[p/2] |= p % 2 == 1 ? lb : lb << 4;
+                rseq[p/2] |= p % 2 == 1 ? rb : rb << 4;
+                lqual[i] = rand() % 256;
+                rqual[i] = i % 7 == 0 ? lqual[i] : rand() % 256;
+            }
+
+            // the expected result, computed base by base
+            vector<uint8_t> expLQual = lqual, expRQual = rqual;
+            vector<char> expLScores(len), expRScores(len);
+            for(int i=0; i<len; i++) {
+                int p = start + i;
+                uint8_t lb = p % 2 == 1 ? lseq[p/2] & 0xF : lseq[p/2] >> 4;
+                uint8_t rb = p % 2 == 1 ? rseq[p/2] & 0xF : rseq[p/2] >> 4;
+                uint8_t lq = lqual[i];
+                uint8_t rq = rqual[i];
+                if(lb == rb) {
+                    expLScores[i] = expRScores[i] = opt.qualScores[(lq + rq) / 2] + 4;
+                } else {
+                    expLQual[i] = max(0, (int)lq - (int)rq);
+                    expRQual[i] = max(0, (int)rq - (int)lq);
+                    expLScores[i] = lq >= rq ? opt.qualScores[lq - rq] - 3 : 0;
+                    expRScores[i] = lq >= rq ? 0 : opt.qualScores[rq - lq] - 3;
+                }
+            }
+
+            for(int k=0; k<kernels.size(); k++) {
+                vector<uint8_t> lbases(len), rbases(len);
+                ColumnVoter::unpackBases(lseq.data(), start, len, lbases.data());
+                ColumnVoter::unpackBases(rseq.data(), start, len, rbases.data());
+                vector<uint8_t> lq = lqual, rq = rqual;
+                vector<char> ls(len), rs(len);
+                kernels[k](lbases.data(), rbases.data(), lq.data(), rq.data(), len, &opt, ls.data(), rs.data());
+                passed &= lq == expLQual && rq == expRQual && ls == expLScores && rs == expRScores;
+            }
+        }
+    }
+
+    if(!passed)
+        cerr << "Pair::test failed" << endl;
+    return passed;
+}
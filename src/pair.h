@@ -6,14 +6,24 @@
 #include "util.h"
 #include "htslib/sam.h"
 #include "options.h"
+#include "umi.h"
+#include "bamutil.h"
+#include "arena.h"
 
 using namespace std;
 
 class Pair {
 public:
-    Pair(Options* opt);
+    // the score buffers are allocated in arena if it's not NULL
+    Pair(Options* opt, Arena* arena = NULL);
     ~Pair();
 
+    // new (arena) Pair(...) allocates the pair in the arena, which should outlive it
+    static void* operator new(size_t size, Arena* arena) {return Arena::allocObject(size, arena);}
+    static void* operator new(size_t size) {return Arena::allocObject(size, NULL);}
+    static void operator delete(void* p, Arena* arena) {Arena::freeObject(p);}
+    static void operator delete(void* p) {Arena::freeObject(p);}
+
     enum MapType{Unknown, ProperlyMapped, CrossRefMapped, OnlyLeftMapped, OnlyRightMapped, NoneMapped};
 
     int getLeftRef();
@@ -27,12 +37,19 @@ public:
 
     void setLeft(bam1_t *b);
     void setRight(bam1_t *b);
+    // with the fields derived when b was read
+    void setLeft(bam1_t *b, const BamReadInfo& info);
+    void setRight(bam1_t *b, const BamReadInfo& info);
     bool pairFound();
     MapType getMapType();
-    string getUMI();
+    const PackedUMI& getUMI();
     string getQName();
-    string getLeftCigar();
-    string getRightCigar();
+    const char* getQNameData();
+    // the ref position after the last aligned base
+    int getLeftEndPos() {return mLeftEndPos;}
+    int getRightEndPos() {return mRightEndPos;}
+    uint64_t getLeftSeqHash() {return mLeftSeqHash;}
+    uint64_t getRightSeqHash() {return mRightSeqHash;}
     void setDuplex(int mergeReadsOfReverseStrand);
     void writeSscsDcsTag();
 
@@ -40,11 +57,12 @@ public:
     
     void dump();
 
+    static bool test();
+
 private:
     void computeScore();
     void writeSscsDcsTagBam(bam1_t* b);
     void assignNonOverlappedScores(uint8_t* qual, int start, int end, char* scores);
-    char qual2score(uint8_t q);
 
 public:
     bam1_t *mLeft;
@@ -58,12 +76,15 @@ public:
 private:
     int mTLEN;
     MapType mMapType;
-    string mUMI;
-    string mLeftCigar;
-    string mRightCigar;
+    PackedUMI mUMI;
+    int mLeftEndPos;
+    int mRightEndPos;
+    uint64_t mLeftSeqHash;
+    uint64_t mRightSeqHash;
     Options* mOptions;
     char* mLeftScore;
     char* mRightScore;
+    Arena* mArena;
     bool mCssDcsTagWritten;
 };
 
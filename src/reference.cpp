@@ -1,5 +1,11 @@
 #include "reference.h"
 #include "util.h"
+#include "tempfiles.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 Reference* Reference::mInstance = NULL;
 
@@ -13,13 +19,27 @@ Reference* Reference::instance(Options* opt) {
 Reference::Reference(Options* opt) {
     mOptions = opt;
     mRef = NULL;
+    mMapped = NULL;
+    mMappedSize = 0;
+    mFastaFd = -1;
     if(!mOptions->refFile.empty()) {
-        mRef = new FastaReader(mOptions, mOptions->refFile);
-        mRef->readAll();
+        string refFile = mOptions->refFile;
+        if(ends_with(refFile, GCREF_SUFFIX))
+            loadIndex(refFile);
+        else if(file_exists(refFile + GCREF_SUFFIX) && file_mtime(refFile + GCREF_SUFFIX) >= file_mtime(refFile))
+            loadIndex(refFile + GCREF_SUFFIX);
+        else {
+            if(file_exists(refFile + GCREF_SUFFIX))
+                cerr << refFile + GCREF_SUFFIX << " is older than " << refFile << ", please run gencore index-ref again" << endl;
+            if(file_exists(refFile + ".fai") && file_mtime(refFile + ".fai") >= file_mtime(refFile))
+                loadFai(refFile);
+            else
+                loadFasta(refFile);
+        }
     }
-    mLastBamContig = -1;
-    mLastData = NULL;
-    mLastLen = -1;
+    mSlots = NULL;
+    mSlotNum = 0;
+    mLengthMismatchReported = false;
 }
 
 Reference::~Reference() {
@@ -27,45 +47,264 @@ Reference::~Reference() {
         delete mRef;
         mRef = NULL;
     }
+    if(mMapped) {
+        munmap(mMapped, mMappedSize);
+        mMapped = NULL;
+    }
+    for(int c=0; c<mSlotNum; c++) {
+        if(mSlots[c].lazy)
+            delete[] mSlots[c].data.load();
+    }
+    delete[] mSlots;
+    mSlots = NULL;
+    if(mFastaFd >= 0)
+        close(mFastaFd);
     mInstance = NULL;
 }
 
-const unsigned char* Reference::getData(int bamContig, int pos, int len) {
-    if(mRef == NULL)
-        return NULL;
-    if(mOptions->bamHeader == NULL)
-        return NULL;
+void Reference::loadFai(const string& fastaFile) {
+    ifstream fai((fastaFile + ".fai").c_str());
+    string line;
+    while(getline(fai, line)) {
+        vector<string> fields;
+        split(line, fields, "\t");
+        if(fields.size() < 5)
+            continue;
+        FaiEntry entry;
+        entry.length = atol(fields[1].c_str());
+        entry.offset = atol(fields[2].c_str());
+        entry.lineBases = atol(fields[3].c_str());
+        entry.lineWidth = atol(fields[4].c_str());
+        if(entry.lineBases <= 0 || entry.lineWidth < entry.lineBases)
+            error_exit("invalid line in " + fastaFile + ".fai: " + line);
+        mFai[fields[0]] = entry;
+        mContigSizes[fields[0]] = entry.length;
+    }
+    if(mFai.empty())
+        error_exit("no contig found in " + fastaFile + ".fai");
+    mFastaFd = open(fastaFile.c_str(), O_RDONLY);
+    if(mFastaFd < 0)
+        error_exit("failed to open the reference: " + fastaFile);
+    cerr << "found " << mFai.size() << " contigs in " << fastaFile << ".fai, they will be loaded when they are used" << endl << endl;
+}
 
-    if(mLastBamContig == bamContig && mLastData!=NULL) {
-        if(pos + len >= mLastLen)
-            return NULL;
-        else
-            return mLastData;
+unsigned char* Reference::loadContig(const string& contigName) {
+    // mFai is not modified after loadFai()
+    const FaiEntry& entry = mFai.find(contigName)->second;
+    // the bases and the line breaks of this contig
+    long rawLen = entry.length / entry.lineBases * entry.lineWidth + entry.length % entry.lineBases;
+    string seq(rawLen, 0);
+    // pread() lets the threads load different contigs at the same time
+    long done = 0;
+    while(done < rawLen) {
+        ssize_t ret = pread(mFastaFd, &seq[done], rawLen - done, entry.offset + done);
+        if(ret <= 0)
+            break;
+        done += ret;
+    }
+    if(done != rawLen)
+        error_exit("failed to read contig " + contigName + " from the reference, please check the .fai file");
+    // same as FastaReader
+    str_keep_valid_sequence(seq, true);
+    if(seq.length() != entry.length)
+        error_exit("contig " + contigName + " doesn't match the .fai file, please run samtools faidx again");
+    if(mOptions->debug)
+        cerr << "loaded contig " << contigName << ": " << entry.length << " bp" << endl;
+    return FastaReader::to4bits(seq);
+}
+
+const unsigned char* Reference::loadSlot(ContigSlot& slot) {
+    lock_guard<mutex> lock(slot.loadMutex);
+    // loaded by another thread while waiting for the lock
+    const unsigned char* data = slot.data.load(memory_order_acquire);
+    if(data == NULL) {
+        data = loadContig(slot.name);
+        slot.data.store(data, memory_order_release);
     }
+    return data;
+}
 
-    // get contig name from bam header
-    string contigName(mOptions->bamHeader->target_name[bamContig]);
+void Reference::release(int bamContig) {
+    if(bamContig < 0 || bamContig >= mSlotNum || !mSlots[bamContig].lazy)
+        return;
+    delete[] mSlots[bamContig].data.exchange(NULL);
+}
 
-    mLastBamContig = bamContig;
+void Reference::releaseBefore(int bamContig) {
+    for(int c=0; c<bamContig && c<mSlotNum; c++)
+        release(c);
+}
 
-    if(mRef->mAllContigs.count(contigName) == 0) {
-        static bool reported = false;
-        if(!reported)
-            cerr << "contig " << contigName << " not found in the reference, please make sure your reference is correct" << endl;
-        reported = true;
-        mLastData = NULL;
-        return NULL;
+void Reference::loadFasta(const string& fastaFile) {
+    mRef = new FastaReader(mOptions, fastaFile);
+    mRef->readAll();
+    map<string, unsigned char*>::iterator iter;
+    for(iter = mRef->mAllContigs.begin(); iter != mRef->mAllContigs.end(); iter++) {
+        mContigs[iter->first] = iter->second;
+        mContigSizes[iter->first] = mRef->mAllContigSizes[iter->first];
+    }
+}
+
+void Reference::loadIndex(const string& indexFile) {
+    int fd = open(indexFile.c_str(), O_RDONLY);
+    if(fd < 0)
+        error_exit("failed to open the reference index: " + indexFile);
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(GcrefHeader)) {
+        close(fd);
+        error_exit("invalid reference index: " + indexFile);
+    }
+    mMappedSize = st.st_size;
+    // the pages are shared by all gencore processes using this reference
+    mMapped = mmap(NULL, mMappedSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mMapped == MAP_FAILED) {
+        mMapped = NULL;
+        error_exit("failed to mmap the reference index: " + indexFile);
+    }
+
+    const char* data = (const char*)mMapped;
+    const GcrefHeader* header = (const GcrefHeader*)data;
+    if(memcmp(header->magic, GCREF_MAGIC, sizeof(GCREF_MAGIC)) != 0)
+        error_exit(indexFile + " is not a reference index made by gencore index-ref");
+    if(header->version != GCREF_VERSION)
+        error_exit(indexFile + " is made by another version of gencore, please run gencore index-ref again");
+
+    const char* table = data + header->tableOffset;
+    const char* end = data + mMappedSize;
+    for(uint32_t c=0; c<header->contigNum; c++) {
+        uint32_t nameLen;
+        uint64_t len, offset;
+        if(table + sizeof(nameLen) > end)
+            error_exit("truncated reference index: " + indexFile);
+        memcpy(&nameLen, table, sizeof(nameLen));
+        table += sizeof(nameLen);
+        if(table + nameLen + sizeof(len) + sizeof(offset) > end)
+            error_exit("truncated reference index: " + indexFile);
+        string name(table, nameLen);
+        table += nameLen;
+        memcpy(&len, table, sizeof(len));
+        table += sizeof(len);
+        memcpy(&offset, table, sizeof(offset));
+        table += sizeof(offset);
+        if(offset + (len + 1) / 2 > mMappedSize)
+            error_exit("truncated reference index: " + indexFile);
+        mContigs[name] = (const unsigned char*)data + offset;
+        mContigSizes[name] = len;
+    }
+    cerr << "mapped " << mContigs.size() << " contigs from " << indexFile << endl << endl;
+}
+
+void Reference::index(const string& fastaFile, const string& indexFile) {
+    Options opt;
+    FastaReader reader(&opt, fastaFile);
+    // written aside and renamed when it's complete, so a broken index is never left with the final name
+    string tmpFile = indexFile + ".tmp." + to_string(getpid());
+    TempFiles::instance()->add(tmpFile);
+    ofstream out(tmpFile.c_str(), ios::out | ios::binary);
+    if(!out.is_open())
+        error_exit("failed to write the reference index: " + tmpFile);
+
+    GcrefHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GCREF_MAGIC, sizeof(GCREF_MAGIC));
+    header.version = GCREF_VERSION;
+    // the table offset is written after all the contigs
+    out.write((const char*)&header, sizeof(header));
+
+    // only one contig is kept in memory
+    vector<string> names;
+    vector<uint64_t> lengths;
+    vector<uint64_t> offsets;
+    uint64_t offset = sizeof(header);
+    const char padding[8] = {0};
+    while(reader.hasNext()) {
+        reader.readNext();
+        if(reader.mCurrentID.empty() && reader.mCurrentSize == 0) {
+            delete[] reader.mCurrentSequence;
+            continue;
+        }
+        uint64_t bytes = (reader.mCurrentSize + 1) / 2;
+        out.write((const char*)reader.mCurrentSequence, bytes);
+        delete[] reader.mCurrentSequence;
+        reader.mCurrentSequence = NULL;
+        cerr << reader.mCurrentID << ": " << reader.mCurrentSize << " bp" << endl;
+        names.push_back(reader.mCurrentID);
+        lengths.push_back(reader.mCurrentSize);
+        offsets.push_back(offset);
+        offset += bytes;
+        // keep the contigs 8-byte aligned
+        int pad = (8 - offset % 8) % 8;
+        out.write(padding, pad);
+        offset += pad;
+    }
+
+    header.contigNum = names.size();
+    header.tableOffset = offset;
+    for(int c=0; c<names.size(); c++) {
+        uint32_t nameLen = names[c].length();
+        out.write((const char*)&nameLen, sizeof(nameLen));
+        out.write(names[c].c_str(), nameLen);
+        out.write((const char*)&lengths[c], sizeof(lengths[c]));
+        out.write((const char*)&offsets[c], sizeof(offsets[c]));
+    }
+    out.seekp(0);
+    out.write((const char*)&header, sizeof(header));
+    out.close();
+    if(out.fail())
+        error_exit("failed to write the reference index: " + tmpFile);
+    if(rename(tmpFile.c_str(), indexFile.c_str()) != 0)
+        error_exit("failed to rename " + tmpFile + " to " + indexFile);
+    // renamed already, so this only forgets it
+    TempFiles::instance()->remove(tmpFile);
+    cerr << endl << "indexed " << names.size() << " contigs to " << indexFile << endl;
+}
+
+void Reference::setBamHeader(bam_hdr_t* hdr) {
+    if(mSlots || mContigSizes.empty())
+        return;
+    mSlotNum = hdr->n_targets;
+    mSlots = new ContigSlot[mSlotNum];
+    int notFound = 0;
+    for(int c=0; c<mSlotNum; c++) {
+        ContigSlot& slot = mSlots[c];
+        slot.name = hdr->target_name[c];
+        slot.data = NULL;
+        slot.lazy = false;
+        slot.length = -1;
+        map<string, long>::iterator iter = mContigSizes.find(slot.name);
+        if(iter == mContigSizes.end()) {
+            if(notFound == 0)
+                cerr << "contig " << slot.name << " not found in the reference, please make sure your reference is correct" << endl;
+            notFound++;
+            continue;
+        }
+        slot.length = iter->second;
+        if(mFai.empty())
+            slot.data = mContigs[slot.name];
+        else
+            slot.lazy = true;
     }
+    if(notFound > 1)
+        cerr << notFound << " contigs of the BAM header are not found in the reference" << endl;
+}
+
+const unsigned char* Reference::getData(int bamContig, int pos, int len) {
+    if(bamContig < 0 || bamContig >= mSlotNum)
+        return NULL;
 
-    if(pos + len >= mRef->mAllContigSizes[contigName]){
-        static bool reported = false;
-        if(!reported)
-            cerr << "contig " << contigName << " doesn't match the length in the reference, please make sure your reference is correct" << endl;
-        mLastData = NULL;
+    ContigSlot& slot = mSlots[bamContig];
+    if(slot.length < 0)
+        return NULL;
+
+    if(pos + len >= slot.length){
+        if(!mLengthMismatchReported.exchange(true))
+            cerr << "contig " << slot.name << " doesn't match the length in the reference, please make sure your reference is correct" << endl;
         return NULL;
     }
 
-    mLastData = mRef->mAllContigs[contigName];
-    mLastLen = mRef->mAllContigSizes[contigName];
-    return mLastData;
-}
\ No newline at end of file
+    const unsigned char* data = slot.data.load(memory_order_acquire);
+    if(data == NULL && slot.lazy)
+        data = loadSlot(slot);
+    return data;
+}
@@ -4,32 +4,94 @@
 // includes
 #include "fastareader.h"
 #include "options.h"
+#include <mutex>
+#include <atomic>
+#include <map>
+#include "htslib/sam.h"
 
 using namespace std;
 
+// the binary reference written by `gencore index-ref`, it's mmapped at startup
+// layout: header | 4-bit packed contigs in the encoding of bam_get_seq(), each 8-byte aligned | contig table
+// contig table: for each contig, uint32 name length, name, uint64 length, uint64 offset of the packed data
+const char GCREF_MAGIC[8] = {'G', 'C', 'R', 'E', 'F', 0, 0, 0};
+const uint32_t GCREF_VERSION = 2;
+const string GCREF_SUFFIX = ".gcref";
+
+// a line of the .fai index made by samtools faidx
+struct FaiEntry {
+    long length;
+    long offset;
+    long lineBases;
+    long lineWidth;
+};
+
+struct GcrefHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t contigNum;
+    uint64_t tableOffset;
+};
+
+// the reference of a contig in the BAM header
+struct ContigSlot {
+    // NULL if it's not loaded yet
+    atomic<const unsigned char*> data;
+    // -1 if it's not in the reference
+    long length;
+    string name;
+    // a lazily loaded contig, owned by this slot
+    bool lazy;
+    mutex loadMutex;
+};
+
 // Singleton reference handler
+// the contigs are resolved against the BAM header once, then getData() can be called by any thread without locking
 
 class Reference
 {
 public:
     ~Reference();
 
+    // map the contigs of the BAM header to the reference, it should be called before getData()
+    void setBamHeader(bam_hdr_t* hdr);
     const unsigned char* getData(int contig, int pos, int len);
+    // free the lazily loaded data of a contig, or of the contigs before a contig, which are finished
+    // no getData() result of these contigs should be in use
+    void release(int contig);
+    void releaseBefore(int contig);
 
     static Reference* instance(Options* opt);
 
+    // write the .gcref file of a FASTA file
+    static void index(const string& fastaFile, const string& indexFile);
+
 private:
     Reference(Options* opt);
+    void loadFasta(const string& fastaFile);
+    void loadIndex(const string& indexFile);
+    void loadFai(const string& fastaFile);
+    const unsigned char* loadSlot(ContigSlot& slot);
+    unsigned char* loadContig(const string& contigName);
 
 private:
     FastaReader* mRef;
+    // the mmapped .gcref file
+    void* mMapped;
+    size_t mMappedSize;
+    // with a .fai index, the contigs are loaded when they are used, and released when they are finished
+    map<string, FaiEntry> mFai;
+    int mFastaFd;
+    // the 4-bit packed data of the contigs, either from mRef or mMapped, it's empty for lazy loading
+    map<string, const unsigned char*> mContigs;
+    map<string, long> mContigSizes;
     static Reference* mInstance;
     Options* mOptions;
-    int mLastBamContig;
-    int mLastLen;
-    const unsigned char* mLastData;
+    // indexed by the contig id of the BAM header
+    ContigSlot* mSlots;
+    int mSlotNum;
+    atomic<bool> mLengthMismatchReported;
 };
 
 
 #endif
-
@@ -0,0 +1,213 @@
+#include "spillruns.h"
+#include "bampool.h"
+#include "util.h"
+#include "tempfiles.h"
+#include <sstream>
+#include <string.h>
+#include <unistd.h>
+
+// merge the runs when there are so many of them, to limit the open files
+const int SPILL_MAX_RUNS = 64;
+
+SpillRuns::SpillRuns(bam_hdr_t* hdr, const string& prefix, htsThreadPool* pool) {
+    mHeader = hdr;
+    mPrefix = prefix;
+    mPool = pool;
+    mFileCount = 0;
+}
+
+SpillRuns::~SpillRuns() {
+    while(!mHeads.empty()) {
+        Run* run = mHeads.top();
+        mHeads.pop();
+        BamPool::instance()->put(run->head.b);
+        closeRun(run);
+    }
+}
+
+samFile* SpillRuns::openRunOutput(string& filename, FILE*& ids, string& idsFilename) {
+    stringstream ss;
+    ss << mPrefix << "." << mFileCount;
+    mFileCount++;
+    filename = ss.str() + ".bam";
+    idsFilename = ss.str() + ".ids";
+    TempFiles::instance()->add(filename);
+    TempFiles::instance()->add(idsFilename);
+    // the runs are read only once, so fast compression is enough
+    samFile* out = sam_open(filename.c_str(), "wb1");
+    if(!out)
+        error_exit("failed to open temporary file " + filename);
+    if(mPool && mPool->pool)
+        hts_set_thread_pool(out, mPool);
+    if(sam_hdr_write(out, mHeader) < 0)
+        error_exit("failed to write temporary file " + filename);
+    // the emitting order of a record is not a BAM field, so it's kept aside
+    ids = fopen(idsFilename.c_str(), "wb");
+    if(!ids)
+        error_exit("failed to open temporary file " + idsFilename);
+    return out;
+}
+
+void SpillRuns::write(samFile* out, FILE* ids, bam1_t* b) {
+    uint64_t id = b->id;
+    if(sam_write1(out, mHeader, b) < 0 || fwrite(&id, sizeof(id), 1, ids) != 1)
+        error_exit("Writing temporary file failed, exiting ...");
+}
+
+void SpillRuns::closeRunOutput(samFile* out, const string& filename, FILE* ids, const string& idsFilename) {
+    if(sam_close(out) < 0)
+        error_exit("failed to close temporary file " + filename);
+    if(fclose(ids) != 0)
+        error_exit("failed to close temporary file " + idsFilename);
+}
+
+void SpillRuns::spill(const vector<bam1_t*>& records) {
+    if(records.empty())
+        return;
+    if(mHeads.size() >= SPILL_MAX_RUNS)
+        compact();
+
+    string filename, idsFilename;
+    FILE* ids = NULL;
+    samFile* out = openRunOutput(filename, ids, idsFilename);
+    for(int i=0; i<records.size(); i++)
+        write(out, ids, records[i]);
+    closeRunOutput(out, filename, ids, idsFilename);
+    addRun(filename, idsFilename);
+}
+
+void SpillRuns::compact() {
+    string filename, idsFilename;
+    FILE* ids = NULL;
+    samFile* out = openRunOutput(filename, ids, idsFilename);
+    while(!empty()) {
+        bam1_t* b = pop();
+        write(out, ids, b);
+        BamPool::instance()->put(b);
+    }
+    closeRunOutput(out, filename, ids, idsFilename);
+    addRun(filename, idsFilename);
+}
+
+void SpillRuns::addRun(const string& filename, const string& idsFilename) {
+    Run* run = new Run();
+    run->filename = filename;
+    run->idsFilename = idsFilename;
+    run->in = sam_open(filename.c_str(), "r");
+    if(!run->in)
+        error_exit("failed to open temporary file " + filename);
+    if(mPool && mPool->pool)
+        hts_set_thread_pool(run->in, mPool);
+    bam_hdr_t* hdr = sam_hdr_read(run->in);
+    if(hdr)
+        bam_hdr_destroy(hdr);
+    run->ids = fopen(idsFilename.c_str(), "rb");
+    if(!run->ids)
+        error_exit("failed to open temporary file " + idsFilename);
+    if(advance(run))
+        mHeads.push(run);
+}
+
+void SpillRuns::closeRun(Run* run) {
+    sam_close(run->in);
+    fclose(run->ids);
+    TempFiles::instance()->remove(run->filename);
+    TempFiles::instance()->remove(run->idsFilename);
+    delete run;
+}
+
+bool SpillRuns::advance(Run* run) {
+    bam1_t* b = BamPool::instance()->get();
+    if(sam_read1(run->in, mHeader, b) < 0) {
+        BamPool::instance()->put(b);
+        closeRun(run);
+        return false;
+    }
+    uint64_t id = 0;
+    if(fread(&id, sizeof(id), 1, run->ids) != 1)
+        error_exit("broken temporary file " + run->idsFilename);
+    b->id = id;
+    run->head = BamOrderKey(b);
+    return true;
+}
+
+bool SpillRuns::empty() {
+    return mHeads.empty();
+}
+
+const BamOrderKey& SpillRuns::top() {
+    return mHeads.top()->head;
+}
+
+bam1_t* SpillRuns::pop() {
+    Run* run = mHeads.top();
+    mHeads.pop();
+    bam1_t* b = run->head.b;
+    if(advance(run))
+        mHeads.push(run);
+    return b;
+}
+
+bool SpillRuns::test() {
+    bool passed = true;
+    bam_hdr_t* hdr = bam_hdr_init();
+    hdr->n_targets = 1;
+    hdr->target_len = (uint32_t*)malloc(sizeof(uint32_t));
+    hdr->target_len[0] = 100000;
+    hdr->target_name = (char**)malloc(sizeof(char*));
+    hdr->target_name[0] = strdup("chr1");
+
+    // two runs with interleaved positions, and a tie broken by the id
+    // the first record of each run has its own ZI tag, which should be kept as it is
+    SpillRuns runs(hdr, "gencore.spilltest." + to_string(getpid()), NULL);
+    int positions[2][3] = {{10, 30, 50}, {20, 30, 40}};
+    const char userTag[2] = {'Z', 'I'};
+    for(int r=0; r<2; r++) {
+        vector<bam1_t*> records;
+        for(int i=0; i<3; i++) {
+            bam1_t* b = bam_init1();
+            b->l_data = b->m_data = 2;
+            b->data = (uint8_t*)calloc(1, b->m_data);
+            b->data[0] = 'r';
+            b->core.l_qname = 2;
+            b->core.tid = 0;
+            b->core.mtid = 0;
+            b->core.pos = positions[r][i];
+            b->id = 1000000000000L * (r + 1) + i;
+            if(i == 0) {
+                int32_t val = 7 + r;
+                bam_aux_append(b, userTag, 'i', sizeof(val), (const uint8_t*)&val);
+            }
+            records.push_back(b);
+        }
+        runs.spill(records);
+        for(int i=0; i<records.size(); i++)
+            bam_destroy1(records[i]);
+    }
+
+    int expectedPos[6] = {10, 20, 30, 30, 40, 50};
+    uint64_t expectedId[6] = {1000000000000L, 2000000000000L, 1000000000001L, 2000000000001L, 2000000000002L, 1000000000002L};
+    for(int i=0; i<6; i++) {
+        if(runs.empty()) {
+            passed = false;
+            break;
+        }
+        bam1_t* b = runs.pop();
+        // the records are not changed
+        passed &= b->core.pos == expectedPos[i] && b->id == expectedId[i];
+        bool tagged = expectedId[i] % 1000 == 0;
+        if(tagged) {
+            uint8_t* tag = bam_aux_get(b, userTag);
+            passed &= b->l_data == 2 + 7 && tag && *tag == 'i' && bam_aux2i(tag) == 7 + expectedId[i] / 1000000000000L - 1;
+        } else {
+            passed &= b->l_data == 2;
+        }
+        BamPool::instance()->put(b);
+    }
+    passed &= runs.empty();
+    bam_hdr_destroy(hdr);
+
+    if(!passed)
+        cerr << "SpillRuns::test failed" << endl;
+    return passed;
+}
@@ -0,0 +1,69 @@
+#ifndef SPILL_RUNS_H
+#define SPILL_RUNS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+#include "bamutil.h"
+#include <vector>
+#include <queue>
+#include <string>
+
+using namespace std;
+
+// Sorted runs of output records spilled to temporary BAM files
+// When the reorder buffer of Gencore is too large, it's written to a new run, and the runs are merged back in BamOrderKey order
+
+class SpillRuns {
+public:
+    // the files are named like <prefix>.<n>.bam, with the emitting order of the records in <prefix>.<n>.ids
+    SpillRuns(bam_hdr_t* hdr, const string& prefix, htsThreadPool* pool);
+    ~SpillRuns();
+
+    // write the records sorted by BamOrderKey to a new run, they are still owned by the caller
+    void spill(const vector<bam1_t*>& records);
+    bool empty();
+    // the key of the smallest record of all the runs, it should not be empty
+    const BamOrderKey& top();
+    // remove the smallest record, which is owned by the caller now
+    bam1_t* pop();
+
+    static bool test();
+
+private:
+    struct Run {
+        samFile* in;
+        string filename;
+        // the ids of the records, a uint64 for each in the order of the run
+        FILE* ids;
+        string idsFilename;
+        BamOrderKey head;
+    };
+    struct RunComp {
+        // reversed for a min-heap
+        bool operator()(const Run* r1, const Run* r2) const {
+            return r2->head < r1->head;
+        }
+    };
+
+    samFile* openRunOutput(string& filename, FILE*& ids, string& idsFilename);
+    void write(samFile* out, FILE* ids, bam1_t* b);
+    void closeRunOutput(samFile* out, const string& filename, FILE* ids, const string& idsFilename);
+    // read the next record of a run, return false if it's finished
+    bool advance(Run* run);
+    void addRun(const string& filename, const string& idsFilename);
+    // close and remove the files of a run
+    void closeRun(Run* run);
+    // merge all the runs to one, to limit the open files
+    void compact();
+
+private:
+    bam_hdr_t* mHeader;
+    string mPrefix;
+    htsThreadPool* mPool;
+    int mFileCount;
+    priority_queue<Run*, vector<Run*>, RunComp> mHeads;
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+// A bounded queue between exactly one producer thread and one consumer thread
+// The items are passed through a lock-free ring, the mutex is only used to park a thread when the ring is full or empty
+
+template<typename T>
+class SpscQueue {
+public:
+    SpscQueue(int capacity) {
+        mSize = capacity + 1;
+        mItems = new T[mSize];
+        mHead = 0;
+        mTail = 0;
+        mClosed = false;
+        mPushWaiting = false;
+        mPopWaiting = false;
+    }
+
+    ~SpscQueue() {
+        delete[] mItems;
+    }
+
+    // called by the producer, it waits while the queue is full
+    void push(const T& item) {
+        size_t tail = mTail.load(memory_order_relaxed);
+        size_t next = (tail + 1) % mSize;
+        if(next == mHead.load(memory_order_acquire)) {
+            unique_lock<mutex> lock(mMutex);
+            mPushWaiting = true;
+            mCV.wait(lock, [&]{return next != mHead.load();});
+            mPushWaiting = false;
+        }
+        mItems[tail] = item;
+        mTail.store(next);
+        // the consumer checks mTail after setting mPopWaiting, so one of them sees the other
+        if(mPopWaiting.load()) {
+            lock_guard<mutex> lock(mMutex);
+            mCV.notify_all();
+        }
+    }
+
+    // called by the consumer, it waits for an item, and returns false if the queue is closed and empty
+    bool pop(T& item) {
+        size_t head = mHead.load(memory_order_relaxed);
+        if(head == mTail.load(memory_order_acquire)) {
+            unique_lock<mutex> lock(mMutex);
+            mPopWaiting = true;
+            mCV.wait(lock, [&]{return head != mTail.load() || mClosed.load();});
+            mPopWaiting = false;
+            if(head == mTail.load())
+                return false;
+        }
+        item = mItems[head];
+        mHead.store((head + 1) % mSize);
+        if(mPushWaiting.load()) {
+            lock_guard<mutex> lock(mMutex);
+            mCV.notify_all();
+        }
+        return true;
+    }
+
+    // called by the producer when it will not push anymore
+    void close() {
+        lock_guard<mutex> lock(mMutex);
+        mClosed = true;
+        mCV.notify_all();
+    }
+
+private:
+    T* mItems;
+    size_t mSize;
+    // the consumer position and the producer position, kept in different cache lines
+    atomic<size_t> mHead;
+    char mPadding[64];
+    atomic<size_t> mTail;
+    atomic<bool> mClosed;
+    atomic<bool> mPushWaiting;
+    atomic<bool> mPopWaiting;
+    mutex mMutex;
+    condition_variable mCV;
+};
+
+#endif
@@ -16,6 +16,7 @@ Stats::Stats(Options* opt) {
 	mIsPostStats = false;
 	mSSCSNum = 0;
 	mDCSNum = 0;
+	mFastPathGroups = 0;
 }
 
 Stats::~Stats() {
@@ -36,6 +37,38 @@ void Stats::addDCS() {
 	mDCSNum++;
 }
 
+void Stats::addFastPathGroup() {
+	mFastPathGroups++;
+}
+
+// merge the counters collected by another thread or contig shard
+void Stats::merge(Stats* other) {
+	mBase += other->mBase;
+	mBaseMismatches += other->mBaseMismatches;
+	mBaseUnmapped += other->mBaseUnmapped;
+	mRead += other->mRead;
+	mReadUnmapped += other->mReadUnmapped;
+	mReadWithMismatches += other->mReadWithMismatches;
+	mCluster += other->mCluster;
+	mMultiMoleculeCluster += other->mMultiMoleculeCluster;
+	mMolecule += other->mMolecule;
+	mMoleculeSE += other->mMoleculeSE;
+	mMoleculePE += other->mMoleculePE;
+	for(int i=0; i<MAX_SUPPORTING_READS; i++)
+		mSupportingHistgram[i] += other->mSupportingHistgram[i];
+	uncountedSupportingReads += other->uncountedSupportingReads;
+	mSSCSNum += other->mSSCSNum;
+	mDCSNum += other->mDCSNum;
+	mFastPathGroups += other->mFastPathGroups;
+
+	for(int c=0; c<mGenomeDepth.size() && c<other->mGenomeDepth.size(); c++) {
+		for(int i=0; i<mGenomeDepth[c].size() && i<other->mGenomeDepth[c].size(); i++)
+			mGenomeDepth[c][i] += other->mGenomeDepth[c][i];
+	}
+	if(mBedStats && other->mBedStats)
+		mBedStats->merge(other->mBedStats);
+}
+
 void Stats::makeGenomeDepthBuf() {
 	mGenomeDepth.clear();
 	for(int c=0; c<mOptions->bamHeader->n_targets; c++) {
@@ -217,6 +250,7 @@ void Stats::print() {
 		cerr << endl;
 		cerr << "Single Stranded Consensus Sequence (has 'FR' tag): " << mSSCSNum << endl;
 		cerr << "Duplex Consensus Sequence (has both 'FS' and 'RR' tags): " << mDCSNum << endl;
+		cerr << "Groups with a single read or identical reads (fast path): " << mFastPathGroups << endl;
 	}
 }
 
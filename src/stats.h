@@ -37,6 +37,8 @@ public:
     void setPostStats(bool flag);
     void addSSCS();
     void addDCS();
+    void addFastPathGroup();
+    void merge(Stats* other);
 
 public:    
 	static string list2string(double* list, int size);
@@ -63,6 +65,8 @@ public:
     bool mIsPostStats;
     long mSSCSNum;
     long mDCSNum;
+    // the groups merged without containment search and column voting, since they have a single read or identical reads
+    long mFastPathGroups;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include "tempfiles.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <iostream>
+
+static void removeTempFilesAtExit() {
+    TempFiles::instance()->removeAll();
+}
+
+TempFiles* TempFiles::instance() {
+    // initialized once even if it's called by multiple threads
+    // it's never destroyed, so it's still there when the exit hook runs
+    static TempFiles* files = new TempFiles();
+    return files;
+}
+
+TempFiles::TempFiles() {
+    atexit(removeTempFilesAtExit);
+}
+
+void TempFiles::add(const string& filename) {
+    lock_guard<mutex> lock(mMutex);
+    mFiles.insert(filename);
+}
+
+void TempFiles::remove(const string& filename) {
+    lock_guard<mutex> lock(mMutex);
+    ::remove(filename.c_str());
+    mFiles.erase(filename);
+}
+
+void TempFiles::removeAll() {
+    lock_guard<mutex> lock(mMutex);
+    set<string>::iterator iter;
+    for(iter = mFiles.begin(); iter != mFiles.end(); iter++)
+        ::remove(iter->c_str());
+    mFiles.clear();
+}
+
+static bool fileExists(const string& filename) {
+    return access(filename.c_str(), F_OK) == 0;
+}
+
+static void touch(const string& filename) {
+    FILE* fp = fopen(filename.c_str(), "w");
+    if(fp)
+        fclose(fp);
+}
+
+bool TempFiles::test() {
+    bool passed = true;
+    string prefix = "gencore.tempfilestest." + to_string(getpid());
+    string file1 = prefix + ".1";
+    string file2 = prefix + ".2";
+    touch(file1);
+    touch(file2);
+
+    TempFiles* files = instance();
+    files->add(file1);
+    files->add(file2);
+    files->remove(file1);
+    passed &= !fileExists(file1) && fileExists(file2);
+    // what error_exit() leaves is removed at exit
+    files->removeAll();
+    passed &= !fileExists(file2);
+    // a forgotten file is not removed
+    touch(file1);
+    files->removeAll();
+    passed &= fileExists(file1);
+    ::remove(file1.c_str());
+
+    // a child exits like error_exit() with a registered file
+    pid_t pid = fork();
+    if(pid == 0) {
+        touch(file2);
+        instance()->add(file2);
+        exit(-1);
+    }
+    int status = 0;
+    passed &= pid > 0 && waitpid(pid, &status, 0) == pid;
+    passed &= WIFEXITED(status) && WEXITSTATUS(status) == 255 && !fileExists(file2);
+    ::remove(file2.c_str());
+
+    if(!passed)
+        cerr << "TempFiles::test failed" << endl;
+    return passed;
+}
@@ -0,0 +1,37 @@
+#ifndef TEMP_FILES_H
+#define TEMP_FILES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <set>
+#include <mutex>
+
+using namespace std;
+
+// Singleton registry of the temporary files
+// The files still registered are removed when the process exits, so that error_exit() doesn't leave them in the tmp dir
+
+class TempFiles {
+public:
+    // the file will be removed at exit unless it's removed by remove()
+    void add(const string& filename);
+    // remove the file now and forget it
+    void remove(const string& filename);
+    // remove all the registered files
+    void removeAll();
+
+    static TempFiles* instance();
+
+    static bool test();
+
+private:
+    TempFiles();
+
+private:
+    set<string> mFiles;
+    // the files are added and removed by multiple threads
+    mutex mMutex;
+};
+
+#endif
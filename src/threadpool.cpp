@@ -0,0 +1,79 @@
+#include "threadpool.h"
+#include <atomic>
+
+ThreadPool::ThreadPool(int threads){
+    mStopped = false;
+    // the calling thread of run() also works, so start one thread less
+    for(int t=0; t<threads-1; t++) {
+        mThreads.push_back(thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopped = true;
+    }
+    mJobCV.notify_all();
+    for(int t=0; t<mThreads.size(); t++) {
+        mThreads[t].join();
+    }
+}
+
+int ThreadPool::size() {
+    return mThreads.size() + 1;
+}
+
+void ThreadPool::work() {
+    while(true) {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mJobCV.wait(lock, [this]{return mStopped || !mJobs.empty();});
+            if(mJobs.empty())
+                return;
+            job = mJobs.front();
+            mJobs.pop_front();
+        }
+        job();
+    }
+}
+
+bool ThreadPool::runOneJob() {
+    function<void()> job;
+    {
+        lock_guard<mutex> lock(mMutex);
+        if(mJobs.empty())
+            return false;
+        job = mJobs.front();
+        mJobs.pop_front();
+    }
+    job();
+    return true;
+}
+
+void ThreadPool::run(int n, const function<void(int)>& task) {
+    if(n <= 0)
+        return;
+
+    atomic<int> remaining(n);
+    {
+        lock_guard<mutex> lock(mMutex);
+        for(int i=0; i<n; i++) {
+            mJobs.push_back([this, &task, &remaining, i]{
+                task(i);
+                if(--remaining == 0) {
+                    lock_guard<mutex> lock(mMutex);
+                    mDoneCV.notify_all();
+                }
+            });
+        }
+    }
+    mJobCV.notify_all();
+
+    // help the workers instead of just waiting
+    while(runOneJob());
+
+    unique_lock<mutex> lock(mMutex);
+    mDoneCV.wait(lock, [&remaining]{return remaining == 0;});
+}
@@ -0,0 +1,39 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// A fixed set of worker threads running batches of indexed tasks
+
+class ThreadPool {
+public:
+    ThreadPool(int threads);
+    ~ThreadPool();
+
+    // run task(0) ... task(n-1) on the workers and the calling thread, and return when all of them are done
+    void run(int n, const function<void(int)>& task);
+    int size();
+
+private:
+    void work();
+    bool runOneJob();
+
+private:
+    vector<thread> mThreads;
+    deque<function<void()>> mJobs;
+    mutex mMutex;
+    condition_variable mJobCV;
+    condition_variable mDoneCV;
+    bool mStopped;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "umi.h"
+#include "util.h"
+#include <vector>
+#include <iostream>
+
+const uint64_t EVEN_BITS = 0x5555555555555555ULL;
+const char UMI_BASES[4] = {'A', 'C', 'G', 'T'};
+
+static inline uint64_t lowBits(int n) {
+    if(n >= 64)
+        return ~0ULL;
+    return (1ULL << n) - 1;
+}
+
+PackedUMI::PackedUMI() {
+    mBases = 0;
+    mUnderscores = 0;
+    mLen = 0;
+    mHalfStart = 0;
+    mHalfSep = -1;
+}
+
+PackedUMI PackedUMI::pack(const char* str, int len) {
+    PackedUMI umi;
+    bool packed = len <= UMI_MAX_LEN;
+    if(!packed)
+        umi.mLong.assign(str, len);
+
+    int underscores = 0;
+    int lastUnderscore = -1;
+    bool leading = true;
+    for(int i=0; i<len; i++) {
+        uint64_t code = 0;
+        switch(str[i]) {
+            case 'A': code = 0; break;
+            case 'C': code = 1; break;
+            case 'G': code = 2; break;
+            case 'T': code = 3; break;
+            default:
+                if(packed)
+                    umi.mUnderscores |= 1ULL << (2*i);
+                if(leading) {
+                    umi.mHalfStart++;
+                } else {
+                    underscores++;
+                    lastUnderscore = i;
+                }
+                continue;
+        }
+        leading = false;
+        if(packed)
+            umi.mBases |= code << (2*i);
+    }
+    umi.mLen = len;
+    if(!leading && underscores == 1)
+        umi.mHalfSep = lastUnderscore;
+    return umi;
+}
+
+PackedUMI PackedUMI::pack(const string& str) {
+    return pack(str.c_str(), str.length());
+}
+
+string PackedUMI::toString() const {
+    if(!packed())
+        return mLong;
+    string str(mLen, '_');
+    for(int i=0; i<mLen; i++) {
+        if(!(mUnderscores & (1ULL << (2*i))))
+            str[i] = UMI_BASES[(mBases >> (2*i)) & 0x03];
+    }
+    return str;
+}
+
+uint64_t PackedUMI::diffBits(const PackedUMI& umi1, const PackedUMI& umi2, int len) {
+    uint64_t x = umi1.mBases ^ umi2.mBases;
+    uint64_t bits = ((x | (x >> 1)) & EVEN_BITS) | (umi1.mUnderscores ^ umi2.mUnderscores);
+    return bits & lowBits(2*len);
+}
+
+uint64_t PackedUMI::getBases(int start, int len) const {
+    if(len <= 0)
+        return 0;
+    return (mBases >> (2*start)) & lowBits(2*len);
+}
+
+int PackedUMI::mismatchesLong(const PackedUMI& umi1, const PackedUMI& umi2) {
+    string s1 = umi1.toString();
+    string s2 = umi2.toString();
+    int len = min(umi1.mLen, umi2.mLen);
+    int mismatches = 0;
+    for(int i=0; i<len; i++) {
+        if(s1[i] != s2[i])
+            mismatches++;
+    }
+    return mismatches;
+}
+
+int PackedUMI::mismatches(const PackedUMI& umi1, const PackedUMI& umi2) {
+    if(!umi1.packed() || !umi2.packed())
+        return mismatchesLong(umi1, umi2);
+    int len = min(umi1.mLen, umi2.mLen);
+    return __builtin_popcountll(diffBits(umi1, umi2, len));
+}
+
+int PackedUMI::diff(const PackedUMI& umi1, const PackedUMI& umi2) {
+    return mismatches(umi1, umi2) + abs(umi1.mLen - umi2.mLen);
+}
+
+bool PackedUMI::isDuplexLong(const PackedUMI& umi1, const PackedUMI& umi2) {
+    string s1 = umi1.toString();
+    string s2 = umi2.toString();
+    return s1.substr(umi1.mHalfStart, umi1.mHalfSep - umi1.mHalfStart) == s2.substr(umi2.mHalfSep + 1)
+        && s1.substr(umi1.mHalfSep + 1) == s2.substr(umi2.mHalfStart, umi2.mHalfSep - umi2.mHalfStart);
+}
+
+bool PackedUMI::isDuplex(const PackedUMI& umi1, const PackedUMI& umi2) {
+    if(umi1.mHalfSep < 0 || umi2.mHalfSep < 0)
+        return false;
+    if(!umi1.packed() || !umi2.packed())
+        return isDuplexLong(umi1, umi2);
+
+    // the halves don't contain '_', so only the bases are compared
+    int firstLen1 = umi1.mHalfSep - umi1.mHalfStart;
+    int secondLen1 = umi1.mLen - umi1.mHalfSep - 1;
+    int firstLen2 = umi2.mHalfSep - umi2.mHalfStart;
+    int secondLen2 = umi2.mLen - umi2.mHalfSep - 1;
+    if(firstLen1 != secondLen2 || secondLen1 != firstLen2)
+        return false;
+
+    return umi1.getBases(umi1.mHalfStart, firstLen1) == umi2.getBases(umi2.mHalfSep + 1, secondLen2)
+        && umi1.getBases(umi1.mHalfSep + 1, secondLen1) == umi2.getBases(umi2.mHalfStart, firstLen2);
+}
+
+bool PackedUMI::operator<(const PackedUMI& other) const {
+    if(!packed() || !other.packed())
+        return toString() < other.toString();
+    int len = min(mLen, other.mLen);
+    uint64_t bits = diffBits(*this, other, len);
+    if(bits == 0)
+        return mLen < other.mLen;
+
+    // compare the first different char, A < C < G < T < _
+    int shift = __builtin_ctzll(bits);
+    int c1 = (mUnderscores >> shift) & 0x01 ? 4 : (mBases >> shift) & 0x03;
+    int c2 = (other.mUnderscores >> shift) & 0x01 ? 4 : (other.mBases >> shift) & 0x03;
+    return c1 < c2;
+}
+
+bool PackedUMI::operator==(const PackedUMI& other) const {
+    return mLen == other.mLen && mBases == other.mBases && mUnderscores == other.mUnderscores && mLong == other.mLong;
+}
+
+bool PackedUMI::test() {
+    bool passed = true;
+
+    const char* umis[] = {"", "A", "AT", "ATCGATCG", "ATCGTTC", "ATCGTTCG", "AAAA_ATCG", "AAAA_ATCT", "ATCG_CTAG", "CTAG_ATCG",
+        "AGC_TGA", "TGA_AGC", "_AGC_TGA", "AGC_", "AT_", "__", "T_A_C", "TTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTT", "_",
+        "AAAA_AAAA", "CTAG", "CCCAGG",
+        // longer than UMI_MAX_LEN
+        "ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGT", "ACGTACGTACGTACGTACGTACGTACGTACGTACGAACGT",
+        "AAAAAAAAAAAAAAAAAAAA_CCCCCCCCCCCCCCCCCCCC", "CCCCCCCCCCCCCCCCCCCC_AAAAAAAAAAAAAAAAAAAA"};
+    int count = sizeof(umis) / sizeof(umis[0]);
+    for(int i=0; i<count; i++) {
+        string s1(umis[i]);
+        PackedUMI u1 = pack(s1);
+        passed &= u1.toString() == s1;
+        for(int j=0; j<count; j++) {
+            string s2(umis[j]);
+            PackedUMI u2 = pack(s2);
+
+            int stringDiff = abs((int)s1.length() - (int)s2.length());
+            for(int k=0; k<min(s1.length(), s2.length()); k++) {
+                if(s1[k] != s2[k])
+                    stringDiff++;
+            }
+            vector<string> halves1, halves2;
+            split(s1, halves1, "_");
+            split(s2, halves2, "_");
+            bool stringDuplex = halves1.size() == 2 && halves2.size() == 2 && halves1[0] == halves2[1] && halves1[1] == halves2[0];
+
+            bool ok = diff(u1, u2) == stringDiff && isDuplex(u1, u2) == stringDuplex
+                && (u1 < u2) == (s1 < s2) && (u1 == u2) == (s1 == s2);
+            if(!ok)
+                cerr << "PackedUMI::test failed with " << s1 << " and " << s2 << endl;
+            passed &= ok;
+        }
+    }
+
+    passed &= diff(pack("ATCGATCG"), pack("ATCGTTC")) == 2;
+    passed &= isDuplex(pack("ATCG_CTAG"), pack("CTAG_ATCG"));
+    passed &= isDuplex(pack("AAAA_AAAA"), pack("AAAA_AAAA"));
+    passed &= !isDuplex(pack("CTAG"), pack("CTAG_ATCG"));
+    passed &= !isDuplex(pack(""), pack(""));
+    passed &= diff(pack("ACGTACGTACGTACGTACGTACGTACGTACGTACGTACGT"), pack("ACGTACGTACGTACGTACGTACGTACGTACGTACGAACGT")) == 1;
+    passed &= isDuplex(pack("AAAAAAAAAAAAAAAAAAAA_CCCCCCCCCCCCCCCCCCCC"), pack("CCCCCCCCCCCCCCCCCCCC_AAAAAAAAAAAAAAAAAAAA"));
+
+    return passed;
+}
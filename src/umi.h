@@ -0,0 +1,65 @@
+#ifndef PACKED_UMI_H
+#define PACKED_UMI_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+// the longest UMI can be packed
+const int UMI_MAX_LEN = 32;
+
+// A UMI made of A/T/C/G/_ packed in integers, so that it can be compared without string operations
+// The i-th char is stored in bits 2i and 2i+1 of mBases, and bit 2i of mUnderscores is set if it's a '_'
+// A UMI longer than UMI_MAX_LEN is kept as a string in mLong, and compared with string operations
+
+class PackedUMI {
+public:
+    PackedUMI();
+
+    // str should only contain A/T/C/G/_
+    static PackedUMI pack(const char* str, int len);
+    static PackedUMI pack(const string& str);
+    string toString() const;
+    bool empty() const {return mLen == 0;}
+    int length() const {return mLen;}
+    bool packed() const {return mLen <= UMI_MAX_LEN;}
+
+    // the number of different chars, plus the length difference
+    static int diff(const PackedUMI& umi1, const PackedUMI& umi2);
+    // the number of different chars in the shorter length
+    static int mismatches(const PackedUMI& umi1, const PackedUMI& umi2);
+    // the two halves split by '_' are swapped, i.e. AAA_TTT and TTT_AAA
+    static bool isDuplex(const PackedUMI& umi1, const PackedUMI& umi2);
+
+    // same order as the UMI strings
+    bool operator<(const PackedUMI& other) const;
+    bool operator==(const PackedUMI& other) const;
+    bool operator!=(const PackedUMI& other) const {return !(*this == other);}
+
+    static bool test();
+
+private:
+    // one bit for each different char in the first len chars
+    static uint64_t diffBits(const PackedUMI& umi1, const PackedUMI& umi2, int len);
+    // the 2-bit codes of len chars starting from start
+    uint64_t getBases(int start, int len) const;
+    // the string versions for the UMIs not packed
+    static int mismatchesLong(const PackedUMI& umi1, const PackedUMI& umi2);
+    static bool isDuplexLong(const PackedUMI& umi1, const PackedUMI& umi2);
+
+public:
+    uint64_t mBases;
+    uint64_t mUnderscores;
+    int mLen;
+    // the first half starts after the leading underscores
+    int mHalfStart;
+    // the position of the '_' between the two halves, -1 if this UMI cannot be split to two halves
+    int mHalfSep;
+    // empty unless this UMI is too long to be packed
+    string mLong;
+};
+
+#endif
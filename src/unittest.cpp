@@ -2,6 +2,16 @@
 #include "bamutil.h"
 #include <time.h>
 #include "cluster.h"
+#include "clusterindex.h"
+#include "bampool.h"
+#include "umi.h"
+#include "columnvoter.h"
+#include "spillruns.h"
+#include "bamwriter.h"
+#include "bamreader.h"
+#include "arena.h"
+#include "pair.h"
+#include "tempfiles.h"
 
 UnitTest::UnitTest(){
 
@@ -11,6 +21,16 @@ void UnitTest::run(){
     bool passed = true;
     passed &= BamUtil::test();
     passed &= Cluster::test();
+    passed &= ClusterIndex::test();
+    passed &= BamPool::test();
+    passed &= PackedUMI::test();
+    passed &= ColumnVoter::test();
+    passed &= SpillRuns::test();
+    passed &= BamWriter::test();
+    passed &= BamReader::test();
+    passed &= Arena::test();
+    passed &= Pair::test();
+    passed &= TempFiles::test();
     printf("\n==========================\n");
     printf("%s\n\n", passed?"PASSED":"FAILED");
 }
\ No newline at end of file
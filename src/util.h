@@ -147,6 +147,15 @@ inline bool file_exists(const  string& s)
     return exists;
 }
 
+// the last modification time of a file, 0 if it doesn't exist
+inline time_t file_mtime(const  string& s)
+{
+    struct stat status;
+    if(stat( s.c_str(), &status ) != 0)
+        return 0;
+    return status.st_mtime;
+}
+
 
 // check if a string is a directory
 inline bool is_directory(const  string& path)